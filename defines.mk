@@ -1,2 +1,7 @@
 # CFLAGS += -DNDEBUG
 # CFLAGS += -DDEBUG_INFO
+# CFLAGS += -DRAMDISK_SECTORS=8192
+# CFLAGS += -DROOT_PART=\"ram0\"
+# CFLAGS += -DRAID_CONF=\"md0=raid0:sdb5,sdd5/md1=raid1:sdb6,sdd6\"
+# 镜像嵌入 kernel.bin 随内核由 loader 读入, 超出 boot.inc 中 KERNEL_SECTOR_CNT 个扇区时构建报错
+# RAMDISK_IMAGE = ramdisk.img
@@ -0,0 +1,536 @@
+#include "io.h"
+#include "pci.h"
+#include "stdio.h"
+#include "debug.h"
+#include "string.h"
+#include "memory.h"
+#include "softirq.h"
+#include "interrupt.h"
+#include "stdio_kernel.h"
+#include "ide.h"
+
+#include "ahci.h"
+
+#define AHCI_MAX_PORTS      32
+#define AHCI_MAX_DISKS      8       // 最多支持的 sata 硬盘数
+#define AHCI_MAX_SLOTS      32      // 每个端口最多的命令槽
+#define AHCI_MAX_SECTORS    1024    // 一条命令最多传输的扇区数
+#define AHCI_PRDT_CNT       ((PG_SIZE - sizeof(hba_cmd_table)) / sizeof(hba_prdt_entry))
+#define AHCI_SPIN_LIMIT     1000000 // 轮询寄存器的最多次数
+
+// HBA 全局寄存器
+#define HBA_CAP     0x00
+#define HBA_GHC     0x04
+#define HBA_IS      0x08
+#define HBA_PI      0x0c
+
+#define HBA_CAP_SNCQ    (1 << 30)   // 支持 NCQ
+#define HBA_GHC_AE      (1 << 31)   // 工作在 AHCI 模式
+#define HBA_GHC_IE      (1 << 1)    // 允许中断
+
+// 端口寄存器, 第 n 个端口位于 0x100 + n * 0x80
+#define PORT_BASE(n)    (0x100 + (n) * 0x80)
+#define PxCLB   0x00
+#define PxCLBU  0x04
+#define PxFB    0x08
+#define PxFBU   0x0c
+#define PxIS    0x10
+#define PxIE    0x14
+#define PxCMD   0x18
+#define PxTFD   0x20
+#define PxSIG   0x24
+#define PxSSTS  0x28
+#define PxSERR  0x30
+#define PxSACT  0x34
+#define PxCI    0x38
+
+#define PxCMD_ST    (1 << 0)    // 开始处理命令列表
+#define PxCMD_SUD   (1 << 1)    // 启动设备
+#define PxCMD_POD   (1 << 2)    // 给设备上电
+#define PxCMD_FRE   (1 << 4)    // 允许接收 FIS
+#define PxCMD_FR    (1 << 14)   // FIS 接收正在运行
+#define PxCMD_CR    (1 << 15)   // 命令列表正在运行
+
+#define PxIS_DHRS   (1 << 0)    // 收到 D2H 寄存器 FIS
+#define PxIS_PSS    (1 << 1)    // 收到 PIO Setup FIS
+#define PxIS_DSS    (1 << 2)    // 收到 DMA Setup FIS
+#define PxIS_SDBS   (1 << 3)    // 收到 Set Device Bits FIS, NCQ 命令以此完成
+#define PxIS_TFES   (1 << 30)   // 任务文件出错
+#define PxIE_DEFAULT (PxIS_DHRS | PxIS_PSS | PxIS_DSS | PxIS_SDBS | PxIS_TFES)
+
+#define SATA_SIG_ATA    0x00000101  // 普通 sata 硬盘的签名
+#define SSTS_DET_PRESENT 3          // 检测到设备且已建立通信
+#define SSTS_IPM_ACTIVE  1          // 接口处于活动状态
+
+#define FIS_TYPE_REG_H2D 0x27
+
+// ata 命令
+#define ATA_CMD_IDENTIFY        0xec
+#define ATA_CMD_READ_DMA        0xc8
+#define ATA_CMD_WRITE_DMA       0xca
+#define ATA_CMD_READ_DMA_EXT    0x25
+#define ATA_CMD_WRITE_DMA_EXT   0x35
+#define ATA_CMD_READ_FPDMA      0x60    // READ FPDMA QUEUED, 即 NCQ 读
+#define ATA_CMD_WRITE_FPDMA     0x61    // WRITE FPDMA QUEUED, 即 NCQ 写
+
+#define ATA_DEV_LBA     0x40
+
+
+// 命令列表中的命令头
+struct hba_cmd_header {
+    uint16_t flags;         // 0-4 位命令 FIS 的双字数, 第 6 位表示写
+    uint16_t prdtl;         // 散列表项数
+    volatile uint32_t prdbc;    // 已传输的字节数, 由 HBA 回写
+    uint32_t ctba;          // 命令表的物理地址, 128 字节对齐
+    uint32_t ctbau;
+    uint32_t reserved[4];
+} __attribute__ ((packed));
+
+
+// 命令表中的散列表项
+struct hba_prdt_entry {
+    uint32_t dba;           // 数据的物理地址
+    uint32_t dbau;
+    uint32_t reserved;
+    uint32_t dbc;           // 0-21 位是字节数减 1, 第 31 位表示完成后中断
+} __attribute__ ((packed));
+
+
+// 命令表, 后面紧跟散列表
+struct hba_cmd_table {
+    uint8_t cfis[64];       // 命令 FIS
+    uint8_t acmd[16];       // ATAPI 命令
+    uint8_t reserved[48];
+} __attribute__ ((packed));
+
+
+// 主机发往设备的寄存器 FIS
+struct fis_reg_h2d {
+    uint8_t fis_type;
+    uint8_t flags;          // 第 7 位置 1 表示这是命令而不是控制
+    uint8_t command;
+    uint8_t featurel;
+    uint8_t lba0;
+    uint8_t lba1;
+    uint8_t lba2;
+    uint8_t device;
+    uint8_t lba3;
+    uint8_t lba4;
+    uint8_t lba5;
+    uint8_t featureh;
+    uint8_t countl;
+    uint8_t counth;
+    uint8_t icc;
+    uint8_t control;
+    uint8_t reserved[4];
+} __attribute__ ((packed));
+
+
+typedef struct hba_cmd_header hba_cmd_header;
+typedef struct hba_prdt_entry hba_prdt_entry;
+typedef struct hba_cmd_table hba_cmd_table;
+typedef struct fis_reg_h2d fis_reg_h2d;
+
+
+// 一个接有硬盘的 sata 端口
+typedef struct ahci_port {
+    volatile uint32_t *regs;        // 端口寄存器
+    uint8_t port_no;
+    hba_cmd_header *cmd_list;       // 32 个命令头共 1KB, 其后是 256 字节的 FIS 接收区
+    hba_cmd_table *cmd_tables[AHCI_MAX_SLOTS];
+    blk_request *slot_req[AHCI_MAX_SLOTS];  // 每个槽上正在执行的一批请求
+    uint32_t issued;                // 已发出还未完成的槽位图
+    uint32_t pending_is;            // 上半部收集的中断状态, 留给下半部处理
+    uint32_t slots;                 // 可用的槽数
+    bool ncq;
+    disk hd;
+    blk_queue queue;
+} ahci_port;
+
+
+static volatile uint32_t *hba;      // 映射后的 HBA 寄存器
+static uint32_t hba_slots;          // HBA 支持的命令槽数
+static bool hba_ncq;                // HBA 是否支持 NCQ
+static ahci_port ahci_ports[AHCI_MAX_DISKS];
+static uint8_t ahci_port_cnt;
+static ahci_port *port_map[AHCI_MAX_PORTS]; // 端口号到端口结构的映射
+static uint32_t ahci_pending;       // 已收到中断, 等待下半部处理的端口位图
+
+
+// 轮询直到 reg 中 mask 的位全部清零, 超时返回 false
+static bool ahci_spin_clear(volatile uint32_t *reg, uint32_t mask) {
+    for (uint32_t i = 0; i < AHCI_SPIN_LIMIT; i++) {
+        if (!(*reg & mask)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+// 停止端口的命令处理和 FIS 接收, 修改命令列表地址前必须先停止
+static void port_stop(ahci_port *port) {
+    port->regs[PxCMD / 4] &= ~PxCMD_ST;
+    ahci_spin_clear(&port->regs[PxCMD / 4], PxCMD_CR);
+    port->regs[PxCMD / 4] &= ~PxCMD_FRE;
+    ahci_spin_clear(&port->regs[PxCMD / 4], PxCMD_FR);
+}
+
+
+static void port_start(ahci_port *port) {
+    ahci_spin_clear(&port->regs[PxCMD / 4], PxCMD_CR);
+    port->regs[PxSERR / 4] = 0xffffffff;    // 写 1 清除
+    port->regs[PxIS / 4] = 0xffffffff;
+    port->regs[PxCMD / 4] |= PxCMD_FRE | PxCMD_SUD | PxCMD_POD;
+    port->regs[PxCMD / 4] |= PxCMD_ST;
+}
+
+
+// 为端口分配命令列表, FIS 接收区和每个槽的命令表
+static bool port_alloc(ahci_port *port) {
+    port->cmd_list = get_kernel_pages(1);
+    if (port->cmd_list == NULL) {
+        return false;
+    }
+    uint32_t clb = addr_v2p((uint32_t)port->cmd_list);
+    port->regs[PxCLB / 4] = clb;
+    port->regs[PxCLBU / 4] = 0;
+    port->regs[PxFB / 4] = clb + 1024;
+    port->regs[PxFBU / 4] = 0;
+
+    for (uint32_t slot = 0; slot < port->slots; slot++) {
+        port->cmd_tables[slot] = get_kernel_pages(1);
+        if (port->cmd_tables[slot] == NULL) {
+            return false;
+        }
+        port->cmd_list[slot].ctba = addr_v2p((uint32_t)port->cmd_tables[slot]);
+        port->cmd_list[slot].ctbau = 0;
+    }
+    return true;
+}
+
+
+/**
+ * 用以 rq 开头的一批请求提交时翻译好的物理地址段填写 slot 号命令表的散列表, 返回表项数.
+ * 与上一项物理上相接的段并入上一项. 请求队列的 max_segments 保证表项够用
+ */
+static uint16_t build_prdt(ahci_port *port, uint32_t slot, blk_request *rq) {
+    hba_prdt_entry *prdt = (hba_prdt_entry *)(port->cmd_tables[slot] + 1);
+    uint32_t cnt = 0;
+    for (blk_request *req = rq; req != NULL; req = req->next) {
+        for (uint32_t idx = 0; idx < req->nr_segs; idx++) {
+            uint32_t phy = req->segs[idx].phy_addr;
+            uint32_t len = req->segs[idx].len;
+            uint32_t last_len = cnt > 0 ? (prdt[cnt - 1].dbc & 0x3fffff) + 1 : 0;
+            if (cnt > 0 && prdt[cnt - 1].dba + last_len == phy) {
+                prdt[cnt - 1].dbc = last_len + len - 1;
+            }
+            else {
+                ASSERT(cnt < AHCI_PRDT_CNT);
+                prdt[cnt].dba = phy;
+                prdt[cnt].dbau = 0;
+                prdt[cnt].reserved = 0;
+                prdt[cnt].dbc = len - 1;
+                cnt++;
+            }
+        }
+    }
+    return cnt;
+}
+
+
+// 在 slot 号命令表中填写读写命令 FIS
+static void build_rw_fis(ahci_port *port, uint32_t slot, uint32_t lba, uint32_t secs, bool is_write) {
+    fis_reg_h2d *fis = (fis_reg_h2d *)port->cmd_tables[slot]->cfis;
+    memset(fis, 0, sizeof(fis_reg_h2d));
+    fis->fis_type = FIS_TYPE_REG_H2D;
+    fis->flags = 0x80;
+    fis->device = ATA_DEV_LBA;
+    fis->lba0 = lba;
+    fis->lba1 = lba >> 8;
+    fis->lba2 = lba >> 16;
+
+    if (port->ncq) {
+        // NCQ 命令的扇区数放在 feature 寄存器, count 寄存器的 3-7 位是标签, 即槽号
+        fis->command = is_write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA;
+        fis->featurel = secs;
+        fis->featureh = secs >> 8;
+        fis->countl = slot << 3;
+        fis->lba3 = lba >> 24;
+    }
+    else if (port->hd.lba48) {
+        fis->command = is_write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+        fis->countl = secs;
+        fis->counth = secs >> 8;
+        fis->lba3 = lba >> 24;
+    }
+    else {
+        fis->command = is_write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA;
+        fis->countl = secs;
+        fis->device |= (lba >> 24) & 0xf;
+    }
+}
+
+
+// 发出 slot 号命令, 调用者需关中断
+static void issue_slot(ahci_port *port, uint32_t slot, uint16_t prdtl, bool is_write) {
+    hba_cmd_header *hdr = &port->cmd_list[slot];
+    hdr->flags = sizeof(fis_reg_h2d) / 4 | (is_write ? (1 << 6) : 0);
+    hdr->prdtl = prdtl;
+    hdr->prdbc = 0;
+
+    port->issued |= 1 << slot;
+    if (port->ncq) {
+        port->regs[PxSACT / 4] = 1 << slot;     // NCQ 命令要先在 SACT 中登记标签
+    }
+    port->regs[PxCI / 4] = 1 << slot;
+}
+
+
+/**
+ * 请求队列的 start 回调, 在关中断下把以 rq 开头的一批请求放进一个空闲槽.
+ * 支持 NCQ 时多个槽可以同时执行, 由硬盘自行安排顺序
+ */
+static void ahci_start(blk_queue *q, blk_request *rq) {
+    ahci_port *port = q->driver_data;
+    uint32_t slot = 0;
+    while (port->issued & (1 << slot)) {
+        slot++;
+    }
+    ASSERT(slot < port->slots);
+
+    uint32_t secs = 0;
+    for (blk_request *req = rq; req != NULL; req = req->next) {
+        secs += req->sec_cnt;
+    }
+    port->slot_req[slot] = rq;
+    build_rw_fis(port, slot, rq->lba, secs, rq->is_write);
+    issue_slot(port, slot, build_prdt(port, slot, rq), rq->is_write);
+}
+
+
+// 以轮询方式执行 identify, 只在初始化时使用
+static bool ahci_identify(ahci_port *port, uint16_t *id_info) {
+    blk_request req;
+    req.buf = id_info;
+    req.sec_cnt = 1;
+    req.next = NULL;
+    blk_map_request(&req);
+
+    fis_reg_h2d *fis = (fis_reg_h2d *)port->cmd_tables[0]->cfis;
+    memset(fis, 0, sizeof(fis_reg_h2d));
+    fis->fis_type = FIS_TYPE_REG_H2D;
+    fis->flags = 0x80;
+    fis->command = ATA_CMD_IDENTIFY;
+
+    intr_status old_status = intr_disable();
+    issue_slot(port, 0, build_prdt(port, 0, &req), false);
+    intr_set_status(old_status);
+
+    bool ok = ahci_spin_clear(&port->regs[PxCI / 4], 1) && !(port->regs[PxIS / 4] & PxIS_TFES);
+    port->issued = 0;
+    port->regs[PxIS / 4] = 0xffffffff;
+    return ok;
+}
+
+
+static void swap_pairs_bytes(const char* dst, char* buf, uint32_t len) {
+    uint32_t idx;
+    for (idx = 0; idx < len; idx += 2) {
+        buf[idx + 1] = *dst++;
+        buf[idx]     = *dst++;
+    }
+    buf[idx] = '\0';
+}
+
+
+// 初始化 port_no 号端口, 识别上面的硬盘并注册为 disk
+static void ahci_port_init(uint8_t port_no) {
+    volatile uint32_t *regs = hba + PORT_BASE(port_no) / 4;
+    uint32_t ssts = regs[PxSSTS / 4];
+    if ((ssts & 0xf) != SSTS_DET_PRESENT || ((ssts >> 8) & 0xf) != SSTS_IPM_ACTIVE ||
+        regs[PxSIG / 4] != SATA_SIG_ATA || ahci_port_cnt >= AHCI_MAX_DISKS) {
+        return;
+    }
+
+    ahci_port *port = &ahci_ports[ahci_port_cnt];
+    port->regs = regs;
+    port->port_no = port_no;
+    port->slots = hba_slots;
+    port->issued = 0;
+    port->pending_is = 0;
+    port->ncq = false;
+    port_stop(port);
+    if (!port_alloc(port)) {
+        printk("    ahci port %d: alloc memory failed\n", port_no);
+        return;
+    }
+    port->regs[PxIE / 4] = 0;
+    port_start(port);
+
+    uint16_t *id_info = sys_malloc(512);
+    if (id_info == NULL || !ahci_identify(port, id_info)) {
+        printk("    ahci port %d: identify failed\n", port_no);
+        sys_free(id_info);
+        port_stop(port);
+        return;
+    }
+
+    disk *hd = &port->hd;
+    sprintf(hd->name, "sd%c", 'a' + channel_cnt * 2 + ahci_port_cnt);
+    hd->my_channel = NULL;
+    hd->dev_no = 0;
+    hd->dma = true;
+    hd->auto_format = false;    // 可能是接入的其它系统的数据盘, 不自动格式化
+    hd->pio_block = 0;
+    hd->lba48 = (id_info[83] & (1 << 10)) != 0;
+    if (hd->lba48) {
+        hd->sectors = *(uint32_t *)&id_info[100];
+        if (*(uint32_t *)&id_info[102] != 0) {
+            hd->sectors = 0xffffffff;
+        }
+    }
+    else {
+        hd->sectors = *(uint32_t *)&id_info[60];
+    }
+    hd->max_sectors = hd->lba48 ? AHCI_MAX_SECTORS : 256;
+
+    // 第 76 字的第 8 位表示支持 NCQ, 第 75 字的低 5 位是队列深度减 1
+    uint32_t depth = 1;
+    if (hba_ncq && (id_info[76] & (1 << 8))) {
+        port->ncq = true;
+        depth = (id_info[75] & 0x1f) + 1;
+        if (depth > port->slots) {
+            depth = port->slots;
+        }
+    }
+
+    char model[48];
+    swap_pairs_bytes((char *)&id_info[27], model, 40);
+    printk("    disk %s on ahci port %d:\n        MODULE: %s\n", hd->name, port_no, model);
+    printk("        SECTORS: %d, CAPACITY: %dMB, LBA48: %s, NCQ: %s, DEPTH: %d\n",
+           hd->sectors, hd->sectors / 2048, hd->lba48 ? "yes" : "no", port->ncq ? "yes" : "no", depth);
+    sys_free(id_info);
+
+    blk_queue_init(&port->queue, hd->name, hd->max_sectors, AHCI_PRDT_CNT, depth, ahci_start, port);
+    hd->queue = &port->queue;
+    port->regs[PxIE / 4] = PxIE_DEFAULT;
+    port_map[port_no] = port;
+    ahci_port_cnt++;
+}
+
+
+// 上半部: 记下各端口的中断状态并清除, 完成请求留给下半部
+static void intr_ahci_handler(uint8_t vec_nr UNUSED) {
+    uint32_t is = hba[HBA_IS / 4];
+    for (uint8_t port_no = 0; port_no < AHCI_MAX_PORTS; port_no++) {
+        if (!(is & (1 << port_no))) {
+            continue;
+        }
+        volatile uint32_t *regs = hba + PORT_BASE(port_no) / 4;
+        uint32_t port_is = regs[PxIS / 4];
+        regs[PxIS / 4] = port_is;   // 先清端口的状态, 再清全局的
+        if (port_map[port_no] != NULL) {
+            port_map[port_no]->pending_is |= port_is;
+            ahci_pending |= 1 << port_no;
+        }
+    }
+    hba[HBA_IS / 4] = is;
+    if (ahci_pending) {
+        raise_softirq(AHCI_SOFTIRQ);
+    }
+}
+
+
+/**
+ * 下半部: 槽在 CI 和 SACT 中都已清零即表示完成.
+ * 出错时 NCQ 的错误恢复要读日志页, 这里简单地让所有在途的命令失败并重启端口
+ */
+static void ahci_do_softirq(void) {
+    intr_status old_status = intr_disable();
+    uint32_t pending = ahci_pending;
+    ahci_pending = 0;
+    intr_set_status(old_status);
+
+    for (uint8_t port_no = 0; pending != 0; port_no++, pending >>= 1) {
+        ahci_port *port = port_map[port_no];
+        if (!(pending & 1) || port == NULL) {
+            continue;
+        }
+
+        blk_request *done_req[AHCI_MAX_SLOTS];
+        old_status = intr_disable();
+        bool error = (port->pending_is & PxIS_TFES) != 0;
+        port->pending_is = 0;
+        uint32_t done = port->issued & ~(port->regs[PxSACT / 4] | port->regs[PxCI / 4]);
+        if (error) {
+            printk("%s: task file error 0x%x, restart port\n", port->hd.name, port->regs[PxTFD / 4]);
+            done = port->issued;
+            port_stop(port);
+            port_start(port);
+        }
+        port->issued &= ~done;
+        for (uint32_t slot = 0; slot < port->slots; slot++) {
+            done_req[slot] = NULL;
+            if (done & (1 << slot)) {
+                done_req[slot] = port->slot_req[slot];
+                port->slot_req[slot] = NULL;
+            }
+        }
+        intr_set_status(old_status);
+
+        for (uint32_t slot = 0; slot < port->slots; slot++) {
+            if (done_req[slot] != NULL) {
+                blk_complete(&port->queue, done_req[slot], error);
+            }
+        }
+    }
+}
+
+
+void ahci_init(void) {
+    printk("\nahci_init start\n");
+    pci_dev *pdev = pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_SATA);
+    if (pdev == NULL) {
+        printk("ahci_init done, no controller\n");
+        return;
+    }
+
+    // BAR5 是 HBA 寄存器的物理地址, ioremap 只能映射内核空间之上的设备内存
+    uint32_t abar = pci_read(pdev, PCI_BAR(5)) & 0xfffffff0;
+    if (abar < 0xc0000000 || pdev->irq_line >= 16) {
+        printk("ahci_init done, unsupported abar 0x%x irq %d\n", abar, pdev->irq_line);
+        return;
+    }
+    pci_enable_bus_master(pdev);
+    hba = ioremap(abar, PORT_BASE(AHCI_MAX_PORTS));
+    hba[HBA_GHC / 4] |= HBA_GHC_AE;
+
+    uint32_t cap = hba[HBA_CAP / 4];
+    hba_slots = ((cap >> 8) & 0x1f) + 1;
+    hba_ncq = (cap & HBA_CAP_SNCQ) != 0;
+    printk("    controller 0x%x:0x%x at 0x%x, irq %d, %d slots, ncq %s\n",
+           pdev->vendor_id, pdev->device_id, abar, pdev->irq_line, hba_slots, hba_ncq ? "yes" : "no");
+
+    open_softirq(AHCI_SOFTIRQ, ahci_do_softirq);
+    uint32_t pi = hba[HBA_PI / 4];
+    for (uint8_t port_no = 0; port_no < AHCI_MAX_PORTS; port_no++) {
+        if (pi & (1 << port_no)) {
+            ahci_port_init(port_no);
+        }
+    }
+    if (ahci_port_cnt == 0) {
+        printk("ahci_init done, no disk\n");
+        return;
+    }
+
+    hba[HBA_IS / 4] = 0xffffffff;
+    request_irq(pdev->irq_line, intr_ahci_handler, "ahci", true);
+    hba[HBA_GHC / 4] |= HBA_GHC_IE;
+
+    // 打开中断之后才能经由请求队列读分区表
+    for (uint8_t idx = 0; idx < ahci_port_cnt; idx++) {
+        disk_partition_scan(&ahci_ports[idx].hd);
+    }
+    printk("ahci_init done\n");
+}
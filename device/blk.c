@@ -0,0 +1,450 @@
+#include "tsc.h"
+#include "debug.h"
+#include "timer.h"
+#include "string.h"
+#include "memory.h"
+#include "interrupt.h"
+#include "stdio_kernel.h"
+#include "ide.h"
+#include "raid.h"
+
+#include "blk.h"
+
+
+/**
+ * bio 是 bio_submit 的一部分, 每部分不超过队列一次传输的扇区数.
+ * 第一部分兼作整体, 记录回调和未完成的部分数, 其余部分指向它.
+ */
+typedef struct bio {
+    blk_request req;
+    struct bio *parent;
+    uint32_t remaining;     // 只对第一部分有意义
+    bool error;             // 只对第一部分有意义
+    bio_end_fn *callback;
+    void *ctx;
+    list_elem free_tag;
+} bio;
+
+
+static list blk_queue_list; // 所有请求队列, 用于打印统计
+
+// 中断下半部中不能调用会加锁的 kfree, 所以 bio 取自固定的池
+static bio bio_pool[BIO_POOL_SIZE];
+static list bio_free_list;
+static semaphore bio_free_cnt;  // 空闲 bio 数, 池空时提交者在此阻塞
+
+
+void blk_queue_init(blk_queue *q, const char *name, uint32_t max_sectors, uint32_t max_segments,
+                    uint32_t max_inflight, blk_start_fn *start, void *driver_data) {
+    q->name = name;
+    list_init(&q->pending);
+    q->inflight = 0;
+    q->max_inflight = max_inflight;
+    q->head_lba = 0;
+    q->max_sectors = max_sectors;
+    q->max_segments = max_segments;
+    q->start = start;
+    q->driver_data = driver_data;
+    q->nr_requests = q->nr_merges = q->nr_dispatch = 0;
+    q->depth = q->max_depth = 0;
+    q->depth_sum = q->service_us = 0;
+    q->max_service_us = 0;
+    list_append(&blk_queue_list, &q->queue_tag);
+}
+
+
+// 按 lba 升序插入 pending, lba 相同的排在后面以保持提交顺序
+static void elv_add(blk_queue *q, blk_request *req) {
+    list_elem *elem = q->pending.head.next;
+    while (elem != &q->pending.tail) {
+        blk_request *r = elem2entry(blk_request, queue_tag, elem);
+        if (r->lba > req->lba) {
+            break;
+        }
+        elem = elem->next;
+    }
+    list_insert_before(elem, &req->queue_tag);
+}
+
+
+/**
+ * 挑选下一个分派的请求.
+ * 若有请求等待超过 BLK_EXPIRE_TICKS, 先分派其中最早提交的, 避免远处的请求饿死;
+ * 否则按 C-LOOK 取磁头之后 lba 最小的请求, 磁头之后没有请求时回到最小的 lba.
+ */
+static blk_request *elv_pick(blk_queue *q) {
+    blk_request *expired = NULL, *next = NULL;
+    for (list_elem *elem = q->pending.head.next; elem != &q->pending.tail; elem = elem->next) {
+        blk_request *r = elem2entry(blk_request, queue_tag, elem);
+        if (ticks - r->submit_ticks >= BLK_EXPIRE_TICKS &&
+            (expired == NULL || (int32_t)(r->submit_ticks - expired->submit_ticks) < 0)) {
+            expired = r;
+        }
+        if (next == NULL && r->lba >= q->head_lba) {
+            next = r;
+        }
+    }
+    if (expired != NULL) {
+        return expired;
+    }
+    if (next != NULL) {
+        return next;
+    }
+    return elem2entry(blk_request, queue_tag, q->pending.head.next);
+}
+
+
+/**
+ * 在提交者的上下文中把 buf 翻译成物理地址段, 物理上相接的页合并为一段.
+ * 驱动在中断下半部中启动请求时, 当前页表属于被中断的任意任务, 不能再翻译用户缓冲区
+ */
+void blk_map_request(blk_request *req) {
+    uint32_t vaddr = (uint32_t)req->buf;
+    uint32_t size = req->sec_cnt * 512;
+    req->nr_segs = 0;
+    while (size > 0) {
+        uint32_t chunk = PG_SIZE - (vaddr & (PG_SIZE - 1));
+        if (chunk > size) {
+            chunk = size;
+        }
+        uint32_t phy = addr_v2p(vaddr);
+        blk_seg *seg = req->segs + req->nr_segs;   // 下一个空闲段
+        if (req->nr_segs > 0 && seg[-1].phy_addr + seg[-1].len == phy) {
+            seg[-1].len += chunk;
+        }
+        else {
+            ASSERT(req->nr_segs < BLK_MAX_SEGS);
+            seg->phy_addr = phy;
+            seg->len = chunk;
+            req->nr_segs++;
+        }
+        vaddr += chunk;
+        size -= chunk;
+    }
+}
+
+
+/**
+ * 在请求数据的 offset 字节处与内核缓冲区 kbuf 之间复制 len 字节, to_req 为 true 时写入请求.
+ * 供 PIO 驱动在中断下半部中使用, 此时提交者的缓冲区可能不在当前地址空间中
+ */
+void blk_copy(blk_request *req, uint32_t offset, void *kbuf, uint32_t len, bool to_req) {
+    blk_seg *seg = req->segs;
+    while (offset >= seg->len) {
+        offset -= seg->len;
+        seg++;
+    }
+    uint8_t *p = kbuf;
+    while (len > 0) {
+        uint32_t phy = seg->phy_addr + offset;
+        uint32_t chunk = seg->len - offset;
+        if (chunk > PG_SIZE - (phy & (PG_SIZE - 1))) {
+            chunk = PG_SIZE - (phy & (PG_SIZE - 1));
+        }
+        if (chunk > len) {
+            chunk = len;
+        }
+
+        intr_status old_status = intr_disable();
+        void *vaddr = kmap_atomic(phy);
+        if (to_req) {
+            memcpy(vaddr, p, chunk);
+        }
+        else {
+            memcpy(p, vaddr, chunk);
+        }
+        intr_set_status(old_status);
+
+        p += chunk;
+        len -= chunk;
+        offset += chunk;
+        if (offset == seg->len) {
+            seg++;
+            offset = 0;
+        }
+    }
+}
+
+
+// 请求的物理地址段数, 驱动要为每段至少准备一个散列表项
+static uint32_t blk_segments(blk_request *req) {
+    return req->nr_segs;
+}
+
+
+// 从 buf 开始最多能传输的扇区数, 使缓冲区跨越的页数不超过 max_segs
+static uint32_t blk_seg_limit(void *buf, uint32_t max_segs) {
+    if (max_segs > BLK_MAX_SEGS) {
+        max_segs = BLK_MAX_SEGS;
+    }
+    return (max_segs * PG_SIZE - ((uint32_t)buf & (PG_SIZE - 1))) / 512;
+}
+
+
+// 硬件还能接受时分派一批请求, 调用者需关中断
+static void blk_dispatch_one(blk_queue *q) {
+    blk_request *req = elv_pick(q);
+    list_elem *elem = req->queue_tag.next;
+    list_remove(&req->queue_tag);
+    blk_request *last = req;
+
+    // pending 按 lba 有序, 紧随其后的请求若与本批首尾相接便一起传输
+    uint32_t end = req->lba + req->sec_cnt;
+    uint32_t total = req->sec_cnt;
+    uint32_t segs = blk_segments(req);
+    while (elem != &q->pending.tail) {
+        blk_request *r = elem2entry(blk_request, queue_tag, elem);
+        if (r->hd != req->hd || r->is_write != req->is_write || r->lba != end ||
+            total + r->sec_cnt > q->max_sectors || segs + blk_segments(r) > q->max_segments) {
+            break;
+        }
+        elem = elem->next;
+        list_remove(&r->queue_tag);
+        last->next = r;
+        last = r;
+        end += r->sec_cnt;
+        total += r->sec_cnt;
+        segs += blk_segments(r);
+        q->nr_merges++;
+    }
+
+    last->next = NULL;
+
+    q->head_lba = end;
+    q->inflight++;
+    q->nr_dispatch++;
+    q->start(q, req);
+}
+
+
+static void blk_dispatch(blk_queue *q) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    while (q->inflight < q->max_inflight && !list_empty(&q->pending)) {
+        blk_dispatch_one(q);
+    }
+}
+
+
+// 提交请求, 不等待完成. 须在 buf 所属的任务中调用
+void blk_submit(blk_queue *q, blk_request *req) {
+    ASSERT(req->sec_cnt > 0 && req->sec_cnt <= q->max_sectors);
+    blk_map_request(req);
+    ASSERT(req->nr_segs <= q->max_segments);
+    req->error = false;
+    intr_status old_status = intr_disable();
+    req->submit_ticks = ticks;
+    req->submit_tsc = rdtsc64();
+    elv_add(q, req);
+
+    q->nr_requests++;
+    q->depth++;
+    q->depth_sum += q->depth;
+    if (q->depth > q->max_depth) {
+        q->max_depth = q->depth;
+    }
+    blk_dispatch(q);
+    intr_set_status(old_status);
+}
+
+
+/**
+ * 驱动在以 rq 开头的一批请求传输结束后调用, 一般位于中断下半部.
+ * 先分派下一批让硬盘尽快继续工作, 再在开中断下逐个调用完成回调.
+ */
+void blk_complete(blk_queue *q, blk_request *rq, bool error) {
+    intr_status old_status = intr_disable();
+    ASSERT(q->inflight > 0);
+    uint64_t now = rdtsc64();
+    for (blk_request *req = rq; req != NULL; req = req->next) {
+        uint32_t us = (uint32_t)cycles_to_us(now - req->submit_tsc);
+        q->service_us += us;
+        if (us > q->max_service_us) {
+            q->max_service_us = us;
+        }
+        q->depth--;
+        req->error = error;
+    }
+    q->inflight--;
+    blk_dispatch(q);
+    intr_set_status(old_status);
+
+    // end_io 可能释放请求, 要先取出 next
+    while (rq != NULL) {
+        blk_request *next = rq->next;
+        rq->end_io(rq);
+        rq = next;
+    }
+}
+
+
+void bio_init(void) {
+    list_init(&blk_queue_list);
+    list_init(&bio_free_list);
+    for (uint32_t idx = 0; idx < BIO_POOL_SIZE; idx++) {
+        list_append(&bio_free_list, &bio_pool[idx].free_tag);
+    }
+    sem_init(&bio_free_cnt, BIO_POOL_SIZE);
+}
+
+
+static bio *bio_alloc(void) {
+    sem_wait(&bio_free_cnt);
+    intr_status old_status = intr_disable();
+    bio *b = elem2entry(bio, free_tag, list_pop(&bio_free_list));
+    intr_set_status(old_status);
+    return b;
+}
+
+
+static void bio_free(bio *b) {
+    intr_status old_status = intr_disable();
+    list_append(&bio_free_list, &b->free_tag);
+    intr_set_status(old_status);
+    sem_post(&bio_free_cnt);
+}
+
+
+// 放下对整体的一份引用, 最后一份放下时调用提交者的回调
+static void bio_put(bio *parent, bool error) {
+    intr_status old_status = intr_disable();
+    parent->error |= error;
+    bool last = --parent->remaining == 0;
+    intr_set_status(old_status);
+
+    if (last) {
+        parent->callback(parent->ctx, parent->error);
+        bio_free(parent);
+    }
+}
+
+
+// 一部分完成, 全部完成后调用提交者的回调
+static void bio_end_io(blk_request *req) {
+    bio *b = req->private;
+    bio *parent = b->parent;
+    if (b != parent) {
+        bio_free(b);
+    }
+    bio_put(parent, req->error);
+}
+
+
+/**
+ * 异步读写 hd 上从 lba 开始的 sec_cnt 个扇区, 提交后立即返回.
+ * 超过一次传输的扇区数或页数上限时拆成几部分, raid 虚拟硬盘还要按块映射到各成员上, 不同通道上的部分并行传输.
+ * 全部完成后在中断下半部中调用 callback. 完成前 buf 必须有效.
+ * bio 池用尽时会阻塞到有空闲为止, 所以只能在线程中调用
+ */
+void bio_submit(struct disk *hd, uint32_t lba, void *buf, uint32_t sec_cnt, bio_dir dir, bio_end_fn *callback, void *ctx) {
+    ASSERT(sec_cnt > 0 && callback != NULL);
+    if (hd->direct != NULL) {
+        callback(ctx, !hd->direct(hd, lba, buf, sec_cnt, dir == BIO_WRITE));
+        return;
+    }
+
+    bio *parent = bio_alloc();
+    parent->parent = parent;
+    parent->remaining = 1;  // 提交者持有一份, 防止前面的部分在提交完之前全部完成
+    parent->error = false;
+    parent->callback = callback;
+    parent->ctx = ctx;
+
+    uint32_t secs_done = 0;
+    bio *b = parent;
+    while (secs_done < sec_cnt) {
+        raid_target targets[RAID_MAX_MEMBERS];
+        uint32_t cnt = 1;
+        uint32_t secs_op = sec_cnt - secs_done;
+        targets[0].hd = hd;
+        targets[0].lba = lba + secs_done;
+        if (hd->raid != NULL) {
+            cnt = raid_map(hd, lba + secs_done, &secs_op, dir == BIO_WRITE, targets);
+        }
+        void *part_buf = (void *)((uint32_t)buf + secs_done * 512);
+        for (uint32_t idx = 0; idx < cnt; idx++) {
+            blk_queue *q = targets[idx].hd->queue;
+            if (secs_op > q->max_sectors) {
+                secs_op = q->max_sectors;
+            }
+            if (secs_op > blk_seg_limit(part_buf, q->max_segments)) {
+                secs_op = blk_seg_limit(part_buf, q->max_segments);
+            }
+        }
+        if (hd->raid != NULL) {
+            raid_account(hd, targets, cnt, secs_op, dir == BIO_WRITE);
+        }
+
+        // raid1 的写把同一段缓冲区提交给每个成员
+        for (uint32_t idx = 0; idx < cnt; idx++) {
+            if (b == NULL) {
+                b = bio_alloc();
+                b->parent = parent;
+            }
+            intr_status old_status = intr_disable();
+            parent->remaining++;
+            intr_set_status(old_status);
+
+            b->req.hd = targets[idx].hd;
+            b->req.lba = targets[idx].lba;
+            b->req.sec_cnt = secs_op;
+            b->req.buf = part_buf;
+            b->req.is_write = dir == BIO_WRITE;
+            b->req.end_io = bio_end_io;
+            b->req.private = b;
+            blk_submit(targets[idx].hd->queue, &b->req);
+            b = NULL;
+        }
+        secs_done += secs_op;
+    }
+    bio_put(parent, false);
+}
+
+
+typedef struct blk_rw_wait {
+    semaphore done;
+    bool error;
+} blk_rw_wait;
+
+
+static void blk_rw_end(void *ctx, bool error) {
+    blk_rw_wait *wait = ctx;
+    wait->error = error;
+    sem_post(&wait->done);
+}
+
+
+// 同步读写, 阻塞到全部扇区完成, 成功返回 true
+bool blk_rw(struct disk *hd, uint32_t lba, void *buf, uint32_t sec_cnt, bio_dir dir) {
+    blk_rw_wait wait;
+    sem_init(&wait.done, 0);
+    wait.error = false;
+    bio_submit(hd, lba, buf, sec_cnt, dir, blk_rw_end, &wait);
+    sem_wait_io(&wait.done);
+    return !wait.error;
+}
+
+
+static bool blk_queue_info(list_elem *pelem, int arg UNUSED) {
+    blk_queue *q = elem2entry(blk_queue, queue_tag, pelem);
+    uint32_t avg_depth = 0, avg_us = 0;
+    uint32_t completed = q->nr_requests - q->depth;
+    if (q->nr_requests != 0) {
+        avg_depth = (uint32_t)div_u64_rem(q->depth_sum, q->nr_requests, NULL);
+    }
+    if (completed != 0) {
+        avg_us = (uint32_t)div_u64_rem(q->service_us, completed, NULL);
+    }
+    printk("    %s   %d   %d   %d/%d   %d   %d/%d/%d   %d/%d\n", q->name,
+        q->nr_requests, q->nr_merges, q->inflight, q->max_inflight, q->nr_dispatch,
+        q->depth, avg_depth, q->max_depth, avg_us, q->max_service_us);
+    return false;
+}
+
+
+void blk_stat_print(void) {
+    printk("block request queues:\n");
+    printk("    NAME   REQS   MERGES   INFLIGHT   DISPATCH   DEPTH(cur/avg/max)   SERVICE_US(avg/max)\n");
+    if (blk_queue_list.head.next != NULL) {
+        list_traversal(&blk_queue_list, blk_queue_info, 0);
+    }
+}
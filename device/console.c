@@ -11,6 +11,7 @@ static lock console_lock;    // 控制台锁
 
 void console_init() {
     lock_init(&console_lock);
+    lock_register(&console_lock, "console");
 }
 
 
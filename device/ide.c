@@ -1,11 +1,14 @@
 #include "io.h"
+#include "tsc.h"
 #include "stdio.h"
 #include "debug.h"
 #include "timer.h"
 #include "string.h"
 #include "memory.h"
+#include "softirq.h"
 #include "interrupt.h"
 #include "stdio_kernel.h"
+#include "pci.h"
 
 #include "ide.h"
 
@@ -23,10 +26,23 @@
 #define reg_alt_status(channel) (channel->port_base + 0x206)
 #define reg_ctl(channel)        reg_alt_status(channel)
 
+// 总线主控(bus master ide)寄存器的端口号
+#define reg_bm_cmd(channel)     (channel->bm_base + 0)
+#define reg_bm_status(channel)  (channel->bm_base + 2)
+#define reg_bm_prdt(channel)    (channel->bm_base + 4)
+
 // reg_alt_status 寄存器的一些关键位
 #define BIT_STAT_BSY    0x80    // 硬盘忙
 #define BIT_STAT_DRDY   0x40    // 驱动器准备好
+#define BIT_STAT_DF     0x20    // 驱动器故障
 #define BIT_STAT_DRQ    0x8     // 数据传输准备好了
+#define BIT_STAT_ERR    0x1     // 上一条命令出错
+
+// 总线主控寄存器的一些关键位
+#define BIT_BM_START    0x1     // cmd: 启动传输
+#define BIT_BM_READ     0x8     // cmd: 方向, 置 1 表示从硬盘写入内存
+#define BIT_BM_ERR      0x2     // status: 传输出错, 写 1 清除
+#define BIT_BM_INTR     0x4     // status: 硬盘已发出中断, 写 1 清除
 
 // device 寄存器的一些关键位
 #define BIT_DEV_MBS 0xa0    // 第 7 位和第 5 位固定为 1
@@ -37,9 +53,32 @@
 #define CMD_IDENTIFY        0xec    // identify 指令
 #define CMD_READ_SECTOR     0x20    // 读扇区指令
 #define CMD_WRITE_SECTOR    0x30    // 写扇区指令
-
-// 定义可读写的最大扇区数, 调试用的
-#define max_lba ((80*1024*1024/512) - 1)    // 只支持 80MB 硬盘
+#define CMD_READ_MULTIPLE   0xc4    // 每个数据块多个扇区的读指令
+#define CMD_WRITE_MULTIPLE  0xc5    // 每个数据块多个扇区的写指令
+#define CMD_SET_MULTIPLE    0xc6    // 设置 READ/WRITE MULTIPLE 每块的扇区数
+#define CMD_READ_DMA        0xc8    // dma 读扇区指令
+#define CMD_WRITE_DMA       0xca    // dma 写扇区指令
+
+// 以上读写指令对应的 48 位 lba 版本
+#define CMD_READ_SECTOR_EXT     0x24
+#define CMD_WRITE_SECTOR_EXT    0x34
+#define CMD_READ_MULTIPLE_EXT   0x29
+#define CMD_WRITE_MULTIPLE_EXT  0x39
+#define CMD_READ_DMA_EXT        0x25
+#define CMD_WRITE_DMA_EXT       0x35
+
+#define IDE_MAX_SECTORS         256     // 28 位 lba 命令一次最多传输的扇区数
+// 48 位 lba 命令本可一次传输 65536 个扇区, 但一个请求最多描述 BLK_MAX_SECTORS 个扇区,
+// 队列的上限须能由单个请求描述, 因此与 28 位命令相同
+#define IDE_MAX_SECTORS_LBA48   BLK_MAX_SECTORS
+#define DRQ_SPIN_LIMIT      100000  // drq_spin 最多读取状态的次数
+#define IDE_SPIN_MIN        16      // ide_wait 自旋次数的下限, 每次读端口约 1us
+#define IDE_SPIN_MAX        1024    // ide_wait 自旋次数的上限
+#define IDE_CMD_TIMEOUT_MS  31000   // ATA 规定设备须在 31s 内完成命令
+#define IDE_HIST_BUCKETS    12      // 延迟直方图的桶数, 第 i 桶为小于 16 << i us, 最后一桶不设上限
+
+#define PRD_EOT         0x8000  // PRD 表最后一项的标志
+#define PRDT_MAX_ENTRY  (PG_SIZE / sizeof(prd_entry))
 
 uint8_t channel_cnt;        // 按硬盘数计算的通道数
 ide_channel channels[2];    // 有两个 ide 通道
@@ -47,6 +86,42 @@ ide_channel channels[2];    // 有两个 ide 通道
 int32_t ext_lba_base = 0;
 uint8_t p_no = 0, l_no = 0; // 用来记录硬盘主分区和逻辑分区的下标
 list partition_list;        // 分区队列
+static uint32_t hd_pending; // 已收到中断, 等待下半部唤醒驱动的通道位图
+
+
+// 每种 ata 命令从发出到完成的延迟统计
+typedef struct ide_cmd_stat {
+    uint8_t cmd;
+    const char* name;
+    uint32_t cnt;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t hist[IDE_HIST_BUCKETS];
+} ide_cmd_stat;
+
+#define CMD_STAT(c, n) {.cmd = c, .name = n}
+
+static ide_cmd_stat cmd_stats[] = {
+    CMD_STAT(CMD_IDENTIFY, "identify"),
+    CMD_STAT(CMD_SET_MULTIPLE, "set_mult"),
+    CMD_STAT(CMD_READ_SECTOR, "read"),
+    CMD_STAT(CMD_WRITE_SECTOR, "write"),
+    CMD_STAT(CMD_READ_MULTIPLE, "read_mul"),
+    CMD_STAT(CMD_WRITE_MULTIPLE, "write_mul"),
+    CMD_STAT(CMD_READ_DMA, "read_dma"),
+    CMD_STAT(CMD_WRITE_DMA, "write_dma"),
+    CMD_STAT(CMD_READ_SECTOR_EXT, "read_ext"),
+    CMD_STAT(CMD_WRITE_SECTOR_EXT, "write_ext"),
+    CMD_STAT(CMD_READ_MULTIPLE_EXT, "rmul_ext"),
+    CMD_STAT(CMD_WRITE_MULTIPLE_EXT, "wmul_ext"),
+    CMD_STAT(CMD_READ_DMA_EXT, "rdma_ext"),
+    CMD_STAT(CMD_WRITE_DMA_EXT, "wdma_ext"),
+};
+
+// ide_wait 的结果统计
+static uint32_t wait_spin_cnt;      // 自旋期间完成的次数
+static uint32_t wait_sleep_cnt;     // 睡眠后由中断唤醒的次数
+static uint32_t wait_timeout_cnt;   // 超时的次数
 
 
 struct partition_table_entry {
@@ -72,8 +147,17 @@ struct boot_sector {
 } __attribute__ ((packed));
 
 
+// PRD 表项, 描述一段物理上连续且不跨 64KB 边界的内存
+struct prd_entry {
+    uint32_t phy_addr;      // 物理地址, 需按 2 字节对齐
+    uint16_t byte_cnt;      // 字节数, 0 表示 64KB
+    uint16_t flags;         // 最后一项置 PRD_EOT
+} __attribute__ ((packed));
+
+
 typedef struct boot_sector boot_sector;
 typedef struct partition_table_entry partition_table_entry;
+typedef struct prd_entry prd_entry;
 
 
 static void select_disk(disk *hd) {
@@ -85,10 +169,25 @@ static void select_disk(disk *hd) {
 }
 
 
-static void select_sector(disk *hd, uint32_t lba, uint8_t sec_cnt) {
-    ASSERT(lba <= max_lba);
+static void select_sector(disk *hd, uint32_t lba, uint32_t sec_cnt) {
+    ASSERT(sec_cnt <= hd->max_sectors && lba + sec_cnt <= hd->sectors);
     ide_channel *channel = hd->my_channel;
 
+    if (hd->lba48) {
+        // 48 位 lba 的扇区数和 lba 寄存器都是两级 FIFO, 先写高字节再写低字节.
+        // lba 只用到 32 位, 40-47 位和 32-39 位写 0; 扇区数 65536 写成两个 0
+        outb(reg_sect_cnt(channel), sec_cnt >> 8);
+        outb(reg_lba_l(channel), lba >> 24);
+        outb(reg_lba_m(channel), 0);
+        outb(reg_lba_h(channel), 0);
+        outb(reg_sect_cnt(channel), sec_cnt);
+        outb(reg_lba_l(channel), lba);
+        outb(reg_lba_m(channel), lba >> 8);
+        outb(reg_lba_h(channel), lba >> 16);
+        outb(reg_dev(channel), BIT_DEV_MBS | BIT_DEV_LBA | (hd->dev_no == 1 ? BIT_DEV_DEV : 0));
+        return;
+    }
+
     // 写入要读写的扇区数
     outb(reg_sect_cnt(channel), sec_cnt);   // 如果 sec_cnt 为 0, 则表示写入 256 个扇区
 
@@ -103,14 +202,62 @@ static void select_sector(disk *hd, uint32_t lba, uint8_t sec_cnt) {
 }
 
 
+// 按硬盘的寻址方式和传输方式选出读写指令
+static uint8_t rw_cmd(disk* hd, bool is_write, bool dma) {
+    if (dma) {
+        if (hd->lba48) {
+            return is_write ? CMD_WRITE_DMA_EXT : CMD_READ_DMA_EXT;
+        }
+        return is_write ? CMD_WRITE_DMA : CMD_READ_DMA;
+    }
+    if (hd->pio_block > 1) {
+        if (hd->lba48) {
+            return is_write ? CMD_WRITE_MULTIPLE_EXT : CMD_READ_MULTIPLE_EXT;
+        }
+        return is_write ? CMD_WRITE_MULTIPLE : CMD_READ_MULTIPLE;
+    }
+    if (hd->lba48) {
+        return is_write ? CMD_WRITE_SECTOR_EXT : CMD_READ_SECTOR_EXT;
+    }
+    return is_write ? CMD_WRITE_SECTOR : CMD_READ_SECTOR;
+}
+
+
 // 向通道 channel 发命令 cmd
 static void cmd_out(ide_channel* channel, uint8_t cmd) {
     // 只要向硬盘发出了命令便将此标记置为 true, 硬盘中断处理程序需要根据它来判断
     channel->expecting_intr = true;
+    channel->cmd = cmd;
+    channel->cmd_tsc = rdtsc64();
     outb(reg_cmd(channel), cmd);
 }
 
 
+// 命令结束时把从 cmd_out 起的延迟计入该命令的直方图
+static void cmd_stat_record(ide_channel* channel) {
+    uint32_t us = (uint32_t)cycles_to_us(rdtsc64() - channel->cmd_tsc);
+    uint32_t bucket = 0;
+    for (uint32_t v = us >> 4; v != 0 && bucket < IDE_HIST_BUCKETS - 1; v >>= 1) {
+        bucket++;
+    }
+
+    for (uint32_t idx = 0; idx < sizeof(cmd_stats) / sizeof(cmd_stats[0]); idx++) {
+        ide_cmd_stat* stat = &cmd_stats[idx];
+        if (stat->cmd == channel->cmd) {
+            intr_status old_status = intr_disable();
+            stat->cnt++;
+            stat->total_us += us;
+            if (us > stat->max_us) {
+                stat->max_us = us;
+            }
+            stat->hist[bucket]++;
+            intr_set_status(old_status);
+            return;
+        }
+    }
+}
+
+
 // 硬盘读入 sec_cnt 个扇区的数据到 buf
 static void read_from_sector(disk* hd, void* buf, uint8_t sec_cnt) {
     uint32_t size_in_byte;
@@ -125,123 +272,304 @@ static void read_from_sector(disk* hd, void* buf, uint8_t sec_cnt) {
 }
 
 
-// 将 buf 中 sec_cnt 扇区的数据写入硬盘
-static void write2sector(disk* hd, void* buf, uint8_t sec_cnt) {
-    uint32_t size_in_byte;
-    if (sec_cnt == 0) {
-        size_in_byte = 256 * 512;
-    }
-    else { 
-        size_in_byte = sec_cnt * 512;
-    }
-    outsw(reg_data(hd->my_channel), buf, size_in_byte / 2);
+static void ide_wait_timeout(void* data) {
+    ide_channel* channel = data;
+    channel->wait_timeout = true;
+    sem_post(&channel->disk_done);
 }
 
 
 /**
- * Q: Why should we `busy_wait` for 30s?
- * A: ATA mannual, quote "All actions required in this state shall be completed with 31s".
+ * 发出 identify 这类不经请求队列的命令并等待其结束, 返回最终的状态寄存器, 超时返回 BIT_STAT_BSY.
+ * 先在 alt status 上自旋, 命令很快结束时省去一次睡眠和唤醒; 否则阻塞在 disk_done 上等中断,
+ * 由定时器保证最多等待 timeout_ms. 自旋上限随结果调整: 自旋中完成则加倍, 需要睡眠则减半.
+ * ATA 规定 "All actions required in this state shall be completed within 31s".
  */
-static bool busy_wait(disk* hd) {
+static uint8_t ide_wait(disk* hd, uint8_t cmd, uint32_t timeout_ms) {
     ide_channel* channel = hd->my_channel;
-    uint16_t time_limit = 30 * 1000;
-    while (time_limit -= 10 >= 0) {
-        if (!(inb(reg_status(channel)) & BIT_STAT_BSY)) {
-            return (inb(reg_status(channel)) & BIT_STAT_DRQ);
+    sem_init(&channel->disk_done, 0);   // 丢弃上一条命令残留的唤醒
+    channel->wait_timeout = false;
+    cmd_out(channel, cmd);
+
+    // 发出命令后要过 400ns 状态才有效, 读 4 次 alt status 来延时
+    uint8_t status = 0;
+    for (uint32_t i = 0; i < 4; i++) {
+        status = inb(reg_alt_status(channel));
+    }
+    for (uint32_t i = 0; i < channel->spin_limit && (status & BIT_STAT_BSY); i++) {
+        status = inb(reg_alt_status(channel));
+    }
+
+    if (!(status & BIT_STAT_BSY)) {
+        // 自旋中已完成, 中断不再需要: 清除设备的中断请求和可能已登记的下半部
+        intr_status old_status = intr_disable();
+        channel->expecting_intr = false;
+        inb(reg_status(channel));
+        hd_pending &= ~(1 << (channel->irq_no - 0x2e));
+        intr_set_status(old_status);
+        if (channel->spin_limit < IDE_SPIN_MAX) {
+            channel->spin_limit *= 2;
         }
-        else {
-            mtime_sleep(10);
+        wait_spin_cnt++;
+        cmd_stat_record(channel);
+        return status;
+    }
+
+    if (channel->spin_limit > IDE_SPIN_MIN) {
+        channel->spin_limit /= 2;
+    }
+    timer_list timer;
+    timer.expires = ticks + msecs_to_ticks(timeout_ms);
+    timer.function = ide_wait_timeout;
+    timer.data = channel;
+    timer.active = false;
+    add_timer(&timer);
+    sem_wait_io(&channel->disk_done);
+    del_timer(&timer);
+
+    if (channel->wait_timeout) {
+        intr_status old_status = intr_disable();
+        channel->expecting_intr = false;
+        hd_pending &= ~(1 << (channel->irq_no - 0x2e));
+        intr_set_status(old_status);
+        wait_timeout_cnt++;
+        printk("%s command 0x%x timeout, status 0x%x\n", hd->name, cmd, inb(reg_alt_status(channel)));
+        return BIT_STAT_BSY;
+    }
+    wait_sleep_cnt++;
+    cmd_stat_record(channel);
+    return inb(reg_alt_status(channel));
+}
+
+
+// 不睡眠地等待 BSY 清除, 返回 DRQ 是否置位. 用于关中断或中断下半部中, 这些地方不能调用 ide_wait
+static bool drq_spin(ide_channel* channel) {
+    for (uint32_t i = 0; i < DRQ_SPIN_LIMIT; i++) {
+        uint8_t status = inb(reg_alt_status(channel));
+        if (!(status & BIT_STAT_BSY)) {
+            return status & BIT_STAT_DRQ;
         }
     }
     return false;
 }
 
 
-void ide_read(disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) { 
-    ASSERT(lba <= max_lba);
-    ASSERT(sec_cnt > 0);
-    lock_acquire(&hd->my_channel->lock);
+/**
+ * 用一批请求提交时翻译好的物理地址段建立 PRD 表.
+ * 一项不能跨 64KB 边界, 所以段在边界处拆开; 与上一项物理上相接且不跨边界的部分并入上一项.
+ * 地址或长度不是 2 字节对齐, 或表项不够时返回 false, 由调用者退回 PIO.
+ */
+static bool build_prdt(ide_channel* channel, blk_request* rq) {
+    prd_entry* prd = channel->prdt;
+    uint32_t cnt = 0;
+    uint32_t cur_len = 0;   // 最后一项的字节数
+    for (blk_request* req = rq; req != NULL; req = req->next) {
+        for (uint32_t idx = 0; idx < req->nr_segs; idx++) {
+            uint32_t phy = req->segs[idx].phy_addr;
+            uint32_t size = req->segs[idx].len;
+            if ((phy | size) & 1) {
+                return false;
+            }
+            while (size > 0) {
+                uint32_t chunk = 0x10000 - (phy & 0xffff);
+                if (chunk > size) {
+                    chunk = size;
+                }
+                if (cnt > 0 && prd[cnt - 1].phy_addr + cur_len == phy &&
+                    (prd[cnt - 1].phy_addr & 0xffff0000) == ((phy + chunk - 1) & 0xffff0000)) {
+                    cur_len += chunk;
+                    prd[cnt - 1].byte_cnt = cur_len;    // 64KB 截断为 0, 正是 PRD 对 64KB 的表示
+                }
+                else {
+                    if (cnt == PRDT_MAX_ENTRY) {
+                        return false;
+                    }
+                    prd[cnt].phy_addr = phy;
+                    prd[cnt].byte_cnt = chunk;
+                    prd[cnt].flags = 0;
+                    cur_len = chunk;
+                    cnt++;
+                }
+                phy += chunk;
+                size -= chunk;
+            }
+        }
+    }
+    prd[cnt - 1].flags = PRD_EOT;
+    return true;
+}
 
-    /* 1 先选择操作的硬盘 */
-    select_disk(hd);
 
-    uint32_t secs_op;       // 每次操作的扇区数
-    uint32_t secs_done = 0; // 已完成的扇区数
-    while(secs_done < sec_cnt) {
-        if ((secs_done + 256) <= sec_cnt) {
-            secs_op = 256;
-        }
-        else {
-            secs_op = sec_cnt - secs_done;
-        }
+// 启动总线主控 dma 传输, 数据由控制器直接搬运, 整批传输结束后硬盘才发中断
+static void dma_start(disk* hd, uint32_t lba, uint32_t secs, bool is_write) {
+    ide_channel* channel = hd->my_channel;
 
-    /* 2 写入待读入的扇区数和起始扇区号 */
-        select_sector(hd, lba + secs_done, secs_op);
+    /* 1 设置 PRD 表地址和传输方向, 清除上次残留的状态 */
+    outb(reg_bm_cmd(channel), 0);
+    outl(reg_bm_prdt(channel), addr_v2p((uint32_t)channel->prdt));
+    outb(reg_bm_cmd(channel), is_write ? 0 : BIT_BM_READ);
+    outb(reg_bm_status(channel), inb(reg_bm_status(channel)) | BIT_BM_ERR | BIT_BM_INTR);
 
-    /* 3 执行的命令写入 reg_cmd 寄存器 */
-        cmd_out(hd->my_channel, CMD_READ_SECTOR);
+    /* 2 写入扇区数和起始扇区号, 发出 dma 命令后再启动总线主控 */
+    select_sector(hd, lba, secs);
+    cmd_out(channel, rw_cmd(hd, is_write, true));
+    outb(reg_bm_cmd(channel), (is_write ? 0 : BIT_BM_READ) | BIT_BM_START);
+}
 
-    /*********************   阻塞自己的时机  ***********************
-     在硬盘已经开始工作(开始在内部读数据或写数据)后才能阻塞自己,现在硬盘已经开始忙了,
-    将自己阻塞,等待硬盘完成读操作后通过中断处理程序唤醒自己*/
-        sem_wait(&hd->my_channel->disk_done);
 
-    /* 4 检测硬盘状态是否可读 */
-        /* 醒来后开始执行下面代码*/
-        if (!busy_wait(hd)) {
-            char error[64];
-            sprintf(error, "%s read sector %d failed!!!!!!\n", hd->name, lba);
-            PANIC(error);
-        }
+// 停止总线主控并检查两边的状态, 出错时关闭该盘的 dma 并返回 false
+static bool dma_finish(disk* hd, uint32_t lba) {
+    ide_channel* channel = hd->my_channel;
+    outb(reg_bm_cmd(channel), 0);
+    uint8_t bm_status = inb(reg_bm_status(channel));
+    uint8_t status = inb(reg_status(channel));
+    outb(reg_bm_status(channel), bm_status | BIT_BM_ERR | BIT_BM_INTR);
+    if ((bm_status & BIT_BM_ERR) || (status & (BIT_STAT_ERR | BIT_STAT_DF | BIT_STAT_BSY))) {
+        printk("%s dma sector %d failed, fall back to pio\n", hd->name, lba);
+        hd->dma = false;
+        return false;
+    }
+    return true;
+}
+
 
-    /* 5 把数据从硬盘的缓冲区中读出 */
-        read_from_sector(hd, (void*)((uint32_t)buf + secs_done * 512), secs_op);
-        secs_done += secs_op;
+/**
+ * 以 PIO 传输一个数据块, 即一次 DRQ 对应的扇区, 由 hd->pio_block 决定.
+ * 一批请求的缓冲区各不相同, 所以逐扇区搬运并在请求之间推进游标.
+ * 中断下半部中提交者的缓冲区可能不在当前地址空间中, 扇区经 pio_buf 与请求的物理地址段交换.
+ * 除了读的最后一块, 每块之后硬盘都会再发中断, 要在搬运数据之前置好 expecting_intr
+ */
+static void pio_xfer_block(ide_channel* channel, disk* hd, bool is_write) {
+    uint32_t secs = hd->pio_block < channel->pio_left ? hd->pio_block : channel->pio_left;
+    channel->pio_left -= secs;
+    channel->expecting_intr = is_write || channel->pio_left > 0;
+    while (secs-- > 0) {
+        blk_request* req = channel->pio_req;
+        uint32_t offset = channel->pio_sec * 512;
+        if (is_write) {
+            blk_copy(req, offset, channel->pio_buf, 512, false);
+            outsw(reg_data(channel), channel->pio_buf, 256);
+        }
+        else {
+            insw(reg_data(channel), channel->pio_buf, 256);
+            blk_copy(req, offset, channel->pio_buf, 512, true);
+        }
+        if (++channel->pio_sec == req->sec_cnt) {
+            channel->pio_req = req->next;
+            channel->pio_sec = 0;
+        }
     }
-    lock_release(&hd->my_channel->lock);
 }
 
 
-void ide_write(disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
-    ASSERT(lba <= max_lba);
-    ASSERT(sec_cnt > 0);
-    lock_acquire (&hd->my_channel->lock);
+/**
+ * 请求队列的 start 回调, 在关中断下启动以 first 开头的一批请求, 不等待传输结束.
+ * 这批请求属于同一块硬盘, lba 首尾相接, 能用 dma 时一条命令传完所有缓冲区;
+ * 否则用 PIO, 每个数据块一次中断: 读在中断下半部中逐块读出, 写在此处写入第一块.
+ */
+static void ide_start(blk_queue* q, blk_request* first) {
+    ide_channel* channel = q->driver_data;
+    disk* hd = first->hd;
+    uint32_t secs = 0;
+    for (blk_request* req = first; req != NULL; req = req->next) {
+        secs += req->sec_cnt;
+    }
 
-    /* 1 先选择操作的硬盘 */
+    channel->cur = first;
     select_disk(hd);
+    channel->dma_active = hd->dma && build_prdt(channel, first);
+    if (channel->dma_active) {
+        dma_start(hd, first->lba, secs, first->is_write);
+        return;
+    }
 
-    uint32_t secs_op;       // 每次操作的扇区数
-    uint32_t secs_done = 0; // 已完成的扇区数
-    while(secs_done < sec_cnt) {
-        if ((secs_done + 256) <= sec_cnt) {
-            secs_op = 256;
-        }
-        else {
-            secs_op = sec_cnt - secs_done;
-        }
+    channel->pio_req = first;
+    channel->pio_sec = 0;
+    channel->pio_left = secs;
+    select_sector(hd, first->lba, secs);
+    if (!first->is_write) {
+        cmd_out(channel, rw_cmd(hd, false, false));
+        return;
+    }
 
-    /* 2 写入待写入的扇区数和起始扇区号 */
-        select_sector(hd, lba + secs_done, secs_op);
+    cmd_out(channel, rw_cmd(hd, true, false));
+    if (!drq_spin(channel)) {
+        // 硬盘不接收数据, 也就不会有中断, 直接交给下半部按出错完成
+        channel->expecting_intr = false;
+        channel->xfer_error = true;
+        hd_pending |= (1 << (channel->irq_no - 0x2e));
+        raise_softirq(HD_SOFTIRQ);
+        return;
+    }
+    pio_xfer_block(channel, hd, true);
+}
 
-    /* 3 执行的命令写入reg_cmd寄存器 */
-        cmd_out(hd->my_channel, CMD_WRITE_SECTOR);
 
-    /* 4 检测硬盘状态是否可读 */
-        if (!busy_wait(hd)) {
-            char error[64];
-            sprintf(error, "%s write sector %d failed!!!!!!\n", hd->name, lba);
-            PANIC(error);
+/**
+ * 硬盘中断的下半部中推进通道上正在传输的一批请求.
+ * PIO 读的每次中断表示一块数据就绪, 写的每次中断表示上一块已写完,
+ * 还有数据块时传输下一块并等待下次中断, 全部结束后才完成这批请求.
+ */
+static void ide_finish(ide_channel* channel) {
+    blk_queue* q = &channel->queue;
+    blk_request* first = channel->cur;
+    disk* hd = first->hd;
+    bool error = channel->xfer_error;
+    channel->xfer_error = false;
+
+    if (channel->dma_active) {
+        cmd_stat_record(channel);
+        if (!dma_finish(hd, first->lba)) {
+            // 这批请求改用 PIO 重做
+            intr_status old_status = intr_disable();
+            ide_start(q, first);
+            intr_set_status(old_status);
+            return;
         }
+    }
+    else if (!error) {
+        if (channel->pio_left > 0) {
+            if (!drq_spin(channel)) {
+                error = true;
+            }
+            else {
+                pio_xfer_block(channel, hd, first->is_write);
+                if (first->is_write || channel->pio_left > 0) {
+                    return;
+                }
+            }
+        }
+        if (!error) {
+            error = (inb(reg_status(channel)) & (BIT_STAT_ERR | BIT_STAT_DF)) != 0;
+        }
+    }
+    if (!channel->dma_active) {
+        cmd_stat_record(channel);
+    }
+    // blk_complete 可能马上启动下一批, 要先清除 cur
+    channel->cur = NULL;
+    blk_complete(q, first, error);
+}
+
+
+// 同步读写, 只是 bio_submit 的包装, 大的传输由 bio 拆分
+void ide_read(disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) { 
+    ASSERT(sec_cnt > 0 && lba + sec_cnt <= hd->sectors);
+    if (!blk_rw(hd, lba, buf, sec_cnt, BIO_READ)) {
+        char error[64];
+        sprintf(error, "%s read sector %d failed!!!!!!\n", hd->name, lba);
+        PANIC(error);
+    }
+}
 
-    /* 5 将数据写入硬盘 */
-        write2sector(hd, (void*)((uint32_t)buf + secs_done * 512), secs_op);
 
-        /* 在硬盘响应期间阻塞自己 */
-        sem_wait(&hd->my_channel->disk_done);
-        secs_done += secs_op;
+void ide_write(disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    ASSERT(sec_cnt > 0 && lba + sec_cnt <= hd->sectors);
+    if (!blk_rw(hd, lba, buf, sec_cnt, BIO_WRITE)) {
+        char error[64];
+        sprintf(error, "%s write sector %d failed!!!!!!\n", hd->name, lba);
+        PANIC(error);
     }
-    /* 醒来后开始释放锁*/
-    lock_release(&hd->my_channel->lock);
 }
 
 
@@ -259,16 +587,8 @@ static void swap_pairs_bytes(const char* dst, char* buf, uint32_t len) {
 static void identify_disk(disk* hd) {
     char id_info[512];
     select_disk(hd);
-    cmd_out(hd->my_channel, CMD_IDENTIFY);
-
-    /**
-     * 向硬盘发送指令后便通过信号量阻塞自己,
-     * 待硬盘处理完成后,通过中断处理程序将自己唤醒
-     */
-    sem_wait(&hd->my_channel->disk_done);
-
-    // 醒来后开始执行下面代码
-    if (!busy_wait(hd)) {
+    uint8_t status = ide_wait(hd, CMD_IDENTIFY, IDE_CMD_TIMEOUT_MS);
+    if ((status & (BIT_STAT_BSY | BIT_STAT_ERR)) || !(status & BIT_STAT_DRQ)) {
         char error[64];
         sprintf(error, "%s identify failed!!!!!!\n", hd->name);
         PANIC(error);
@@ -285,9 +605,40 @@ static void identify_disk(disk* hd) {
     memset(buf, 0, sizeof(buf));
     swap_pairs_bytes(&id_info[md_start], buf, md_len);
     printk("        MODULE: %s\n", buf);
-    uint32_t sectors = *(uint32_t*)&id_info[60 * 2];
-    printk("        SECTORS: %d\n", sectors);
-    printk("        CAPACITY: %dMB\n", sectors * 512 / 1024 / 1024);
+
+    // 第 83 字的第 10 位表示支持 48 位 lba, 此时容量在第 100-103 字, 否则在第 60-61 字.
+    // lba 只用 32 位, 超过 2TB 的部分不使用
+    hd->lba48 = (*(uint16_t*)&id_info[83 * 2] & (1 << 10)) != 0;
+    if (hd->lba48) {
+        hd->sectors = *(uint32_t*)&id_info[100 * 2];
+        if (*(uint32_t*)&id_info[102 * 2] != 0) {
+            hd->sectors = 0xffffffff;
+        }
+        hd->max_sectors = IDE_MAX_SECTORS_LBA48;
+    }
+    else {
+        hd->sectors = *(uint32_t*)&id_info[60 * 2];
+        hd->max_sectors = IDE_MAX_SECTORS;
+    }
+    printk("        SECTORS: %d, LBA48: %s\n", hd->sectors, hd->lba48 ? "yes" : "no");
+    printk("        CAPACITY: %dMB\n", hd->sectors / 2048);
+
+    // 第 49 字的第 8 位表示支持 dma
+    uint16_t caps = *(uint16_t*)&id_info[49 * 2];
+    hd->dma = hd->my_channel->bm_base != 0 && (caps & (1 << 8));
+    printk("        DMA: %s\n", hd->dma ? "yes" : "no");
+
+    // 第 47 字的低 8 位是 READ/WRITE MULTIPLE 每块最多的扇区数, 为 0 表示不支持
+    hd->pio_block = 1;
+    uint8_t max_multiple = *(uint16_t*)&id_info[47 * 2] & 0xff;
+    if (max_multiple > 1) {
+        select_disk(hd);
+        outb(reg_sect_cnt(hd->my_channel), max_multiple);
+        if (!(ide_wait(hd, CMD_SET_MULTIPLE, IDE_CMD_TIMEOUT_MS) & (BIT_STAT_BSY | BIT_STAT_ERR))) {
+            hd->pio_block = max_multiple;
+        }
+    }
+    printk("        PIO BLOCK: %d sectors\n", hd->pio_block);
 }
 
 
@@ -342,6 +693,14 @@ static void partition_scan(disk* hd, uint32_t ext_lba) {
 }
 
 
+// 扫描整块硬盘上的分区并加入 partition_list, 其它块设备驱动注册硬盘时也用它
+void disk_partition_scan(disk* hd) {
+    ext_lba_base = 0;
+    p_no = 0, l_no = 0;
+    partition_scan(hd, 0);
+}
+
+
 // 打印分区信息
 static bool partition_info(list_elem* pelem, int arg UNUSED) {
     partition* part = elem2entry(partition, part_tag, pelem);
@@ -362,16 +721,58 @@ void intr_hd_handler(uint8_t irq_no) {
 
     if (channel->expecting_intr) {
         channel->expecting_intr = false;
-        sem_post(&channel->disk_done);
 
         // 读取状态寄存器使硬盘控制器认为此次的中断已被处理,从而硬盘可以继续执行新的读写 */
         inb(reg_status(channel));
+
+        // 唤醒驱动程序留给下半部
+        hd_pending |= (1 << ch_no);
+        raise_softirq(HD_SOFTIRQ);
+    }
+}
+
+
+// 硬盘软中断: 结束请求队列中的传输, 或唤醒在 disk_done 上等待的驱动程序
+static void hd_do_softirq(void) {
+    intr_status old_status = intr_disable();
+    uint32_t pending = hd_pending;
+    hd_pending = 0;
+    intr_set_status(old_status);
+
+    for (uint8_t ch_no = 0; ch_no < channel_cnt; ch_no++) {
+        if (pending & (1 << ch_no)) {
+            // 请求队列在传输时由队列处理, 否则是 identify 之类的直接命令
+            if (channels[ch_no].cur != NULL) {
+                ide_finish(&channels[ch_no]);
+            }
+            else {
+                sem_post(&channels[ch_no].disk_done);
+            }
+        }
     }
 }
 
 
+// 找到 PIIX 之类的 ide 控制器, 返回总线主控寄存器基址, 没有则返回 0
+static uint16_t ide_bus_master_base(void) {
+    pci_dev* pdev = pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE);
+    // prog_if 第 7 位表示支持总线主控
+    if (pdev == NULL || !(pdev->prog_if & 0x80)) {
+        return 0;
+    }
+    uint32_t bar4 = pci_read(pdev, PCI_BAR(4));
+    if (!(bar4 & 0x1)) {    // 总线主控寄存器必须在 io 空间
+        return 0;
+    }
+    pci_enable_bus_master(pdev);
+    printk("    ide controller 0x%x:0x%x, bus master at 0x%x\n", pdev->vendor_id, pdev->device_id, bar4 & 0xfffc);
+    return bar4 & 0xfffc;
+}
+
+
 void ide_init() {
     printk("\nide_init start\n");
+    uint16_t bm_base = ide_bus_master_base();
     uint8_t hd_cnt = *((uint8_t *)(0x475)); // 获取硬盘的数量
     ASSERT(hd_cnt > 0);
     channel_cnt = DIV_ROUND_UP(hd_cnt, 2);  // 一个 ide 通道上有两个硬盘, 根据硬盘数量反推有几个 ide 通道
@@ -379,6 +780,7 @@ void ide_init() {
     uint8_t channel_no = 0, dev_no = 0;
 
     list_init(&partition_list);
+    open_softirq(HD_SOFTIRQ, hd_do_softirq);
 
     // 处理每个通道上的硬盘
     while (channel_no < channel_cnt) {
@@ -398,23 +800,43 @@ void ide_init() {
         }
 
         channel->expecting_intr = false;    // 未向硬盘写入指令时不期待硬盘的中断
-        lock_init(&channel->lock);
 
         // 初始化为0, 目的是向硬盘控制器请求数据后, 硬盘驱动 sem_wait 此信号量会阻塞线程.
         // 直到硬盘完成后通过发中断, 由中断处理程序将此信号量 sem_post, 唤醒线程.
         sem_init(&channel->disk_done, 0);
-        register_handler(channel->irq_no, intr_hd_handler);
+        // 两块硬盘共用队列, 一批的上限取两者中较小的, 在 identify 之后确定
+        blk_queue_init(&channel->queue, channel->name, IDE_MAX_SECTORS_LBA48, PRDT_MAX_ENTRY, 1, ide_start, channel);
+        channel->cur = NULL;
+        channel->spin_limit = IDE_SPIN_MIN;
+        channel->dma_active = false;
+        channel->xfer_error = false;
+        // ide1 的 IRQ15 在 8259A 和 IOAPIC 上默认都没有打开, 统一经由 request_irq 注册
+        request_irq(channel->irq_no - 0x20, intr_hd_handler, channel->name, false);
+
+        // 第二个通道的总线主控寄存器在第一个之后 8 个端口处
+        channel->bm_base = bm_base ? bm_base + channel_no * 8 : 0;
+        channel->prdt = NULL;
+        if (channel->bm_base) {
+            channel->prdt = get_kernel_pages(1);
+            if (channel->prdt == NULL) {
+                channel->bm_base = 0;
+            }
+        }
 
         while (dev_no < 2) {
             disk* hd = &channel->devices[dev_no];
             hd->my_channel = channel;
+            hd->queue = &channel->queue;
             hd->dev_no = dev_no;
+            hd->auto_format = true;
             sprintf(hd->name, "sd%c", 'a' + channel_no * 2 + dev_no);
             identify_disk(hd);  // 获取硬盘参数
+            if (hd->max_sectors < channel->queue.max_sectors) {
+                channel->queue.max_sectors = hd->max_sectors;
+            }
             if (dev_no != 0) {  // 内核本身的裸硬盘(hd60M.img)不处理
-                partition_scan(hd, 0);  // 扫描该硬盘上的分区  
+                disk_partition_scan(hd);    // 扫描该硬盘上的分区
             }
-            p_no = 0, l_no = 0;
             dev_no++;
         }
         dev_no = 0;
@@ -424,3 +846,26 @@ void ide_init() {
     list_traversal(&partition_list, partition_info, (int)NULL);
     printk("ide_init done\n");
 }
+
+
+// 打印每种命令的延迟直方图, 以及 ide_wait 自旋和睡眠的次数
+void ide_stat_print(void) {
+    printk("ide wait: spin %d, sleep %d, timeout %d, spin limit", wait_spin_cnt, wait_sleep_cnt, wait_timeout_cnt);
+    for (uint8_t ch_no = 0; ch_no < channel_cnt; ch_no++) {
+        printk(" %s=%d", channels[ch_no].name, channels[ch_no].spin_limit);
+    }
+    printk("\nide command latency (us):\n");
+    printk("    CMD   CNT   AVG   MAX   <16 <32 <64 <128 <256 <512 <1m <2m <4m <8m <16m >=16m\n");
+    for (uint32_t idx = 0; idx < sizeof(cmd_stats) / sizeof(cmd_stats[0]); idx++) {
+        ide_cmd_stat* stat = &cmd_stats[idx];
+        if (stat->cnt == 0) {
+            continue;
+        }
+        printk("    %s   %d   %d   %d  ", stat->name, stat->cnt,
+               (uint32_t)div_u64_rem(stat->total_us, stat->cnt, NULL), stat->max_us);
+        for (uint32_t bucket = 0; bucket < IDE_HIST_BUCKETS; bucket++) {
+            printk(" %d", stat->hist[bucket]);
+        }
+        printk("\n");
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef __DEVICE_AHCI_H__
+#define __DEVICE_AHCI_H__
+
+#include "stdint.h"
+#include "global.h"
+
+
+void ahci_init(void);
+
+#endif
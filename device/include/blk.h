@@ -0,0 +1,111 @@
+#ifndef __DEVICE_BLK_H__
+#define __DEVICE_BLK_H__
+
+#include "list.h"
+#include "sync.h"
+#include "stdint.h"
+#include "global.h"
+
+#define BLK_EXPIRE_TICKS    50  // 请求等待超过 500ms 便不再按 lba 排序, 优先分派
+#define BIO_POOL_SIZE       64  // 同时在途的 bio 数上限
+#define BLK_MAX_SEGS        33  // 一个请求的缓冲区最多跨越的页数, 即 128KB 加上不按页对齐多出的一页
+#define BLK_MAX_SECTORS     256 // 一个请求最多的扇区数 (128KB), 由 BLK_MAX_SEGS 决定
+
+
+struct disk;
+struct blk_queue;
+
+
+typedef enum bio_dir {
+    BIO_READ,
+    BIO_WRITE
+} bio_dir;
+
+
+/**
+ * bio 完成回调, 在中断下半部中以开中断状态调用, 不能阻塞.
+ * error 为 true 表示其中某一部分传输失败
+ */
+typedef void bio_end_fn(void *ctx, bool error);
+
+
+// 缓冲区中物理地址连续的一段
+typedef struct blk_seg {
+    uint32_t phy_addr;
+    uint32_t len;           // 字节数
+} blk_seg;
+
+
+// 一次块设备读写请求, 由提交者提供内存, 完成前不能释放
+typedef struct blk_request {
+    struct disk *hd;        // 目标硬盘
+    uint32_t lba;           // 起始扇区
+    uint32_t sec_cnt;       // 扇区数
+    void *buf;              // 只在提交者的地址空间中有效, 驱动只能使用 segs
+    blk_seg segs[BLK_MAX_SEGS]; // 提交时由 blk_map_request 从 buf 翻译出的物理地址段
+    uint32_t nr_segs;
+    bool is_write;
+    bool error;             // 完成时由驱动设置
+    uint32_t submit_ticks;  // 提交时的 ticks, 用于判断是否超时
+    uint64_t submit_tsc;    // 提交时的 tsc, 用于统计服务时间
+    list_elem queue_tag;    // 在 pending 队列中的标记
+    struct blk_request *next;   // 分派后同一批中 lba 紧随其后的请求
+    void (*end_io)(struct blk_request *req);    // 完成回调, 在中断下半部中以开中断状态调用
+    void *private;          // 供 end_io 使用
+} blk_request;
+
+
+/**
+ * 不经请求队列, 在调用者的上下文中同步完成的读写, 用于内存盘这类没有传输延迟的设备.
+ * 成功返回 true
+ */
+typedef bool blk_direct_fn(struct disk *hd, uint32_t lba, void *buf, uint32_t sec_cnt, bool is_write);
+
+
+// 驱动启动以 rq 开头, 经 next 相连的一批请求, 在关中断下调用, 不能阻塞
+typedef void blk_start_fn(struct blk_queue *q, blk_request *rq);
+
+
+/**
+ * 块设备请求队列, 每个可以独立传输的硬件通道一个.
+ * pending 按 lba 升序排列, 分派时用 C-LOOK 挑选, 并把 lba 相邻的请求合并成一次传输.
+ * 硬件能同时执行 max_inflight 批, 如 ide 通道为 1, 支持 NCQ 的 sata 端口可达 32.
+ * 驱动在每批传输完成的中断下半部中调用 blk_complete, 由其分派下一批.
+ */
+typedef struct blk_queue {
+    const char *name;
+    list pending;           // 等待分派的请求
+    uint32_t inflight;      // 正在传输的批数
+    uint32_t max_inflight;  // 硬件能同时执行的批数
+    uint32_t head_lba;      // 上一批请求结束的位置, 相当于磁头位置
+    uint32_t max_sectors;   // 一批请求最多的扇区数
+    uint32_t max_segments;  // 一批请求的缓冲区最多跨越的页数, 受驱动散列表大小限制
+    blk_start_fn *start;
+    void *driver_data;
+    list_elem queue_tag;    // 在全部队列链表中的标记
+
+    // 统计
+    uint32_t nr_requests;   // 提交的请求数
+    uint32_t nr_merges;     // 被合并进其它请求一起传输的请求数
+    uint32_t nr_dispatch;   // 启动的传输次数
+    uint32_t depth;         // 当前排队及传输中的请求数
+    uint32_t max_depth;
+    uint64_t depth_sum;     // 每次提交时 depth 的累加, 用于求平均深度
+    uint64_t service_us;    // 所有请求从提交到完成的总时间
+    uint32_t max_service_us;
+} blk_queue;
+
+
+void blk_queue_init(blk_queue *q, const char *name, uint32_t max_sectors, uint32_t max_segments,
+                    uint32_t max_inflight, blk_start_fn *start, void *driver_data);
+void blk_map_request(blk_request *req);
+void blk_copy(blk_request *req, uint32_t offset, void *kbuf, uint32_t len, bool to_req);
+void blk_submit(blk_queue *q, blk_request *req);
+void blk_complete(blk_queue *q, blk_request *rq, bool error);
+
+void bio_init(void);
+void bio_submit(struct disk *hd, uint32_t lba, void *buf, uint32_t sec_cnt, bio_dir dir, bio_end_fn *callback, void *ctx);
+bool blk_rw(struct disk *hd, uint32_t lba, void *buf, uint32_t sec_cnt, bio_dir dir);
+void blk_stat_print(void);
+
+#endif
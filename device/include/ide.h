@@ -1,6 +1,7 @@
 #ifndef __DEVICE_IDE_H__
 #define __DEVICE_IDE_H__
 
+#include "blk.h"
 #include "sync.h"
 #include "stdint.h"
 #include "bitmap.h"
@@ -25,7 +26,16 @@ typedef struct partition {
 typedef struct disk {
     char name[8];                   // 本硬盘的名称
     struct ide_channel* my_channel; // 此块硬盘归属于哪个 ide 通道
+    struct blk_queue* queue;        // 读写请求提交到的队列, 虚拟硬盘为 NULL
+    struct raid_dev* raid;          // 软件 raid 的虚拟硬盘, 读写被映射到成员分区上
+    blk_direct_fn* direct;          // 不为 NULL 时读写直接调用它, 如内存盘
     uint8_t dev_no;                 // 本硬盘是主 0 还是从 1
+    uint32_t sectors;               // 总扇区数, 由 identify 得到
+    uint32_t max_sectors;           // 一条命令最多传输的扇区数
+    bool lba48;                     // 是否使用 48 位 lba 命令
+    bool dma;                       // 硬盘支持 dma 且通道有总线主控时为 true
+    uint16_t pio_block;             // PIO 每次 DRQ 传输的扇区数, 大于 1 时使用 READ/WRITE MULTIPLE
+    bool auto_format;               // 分区上没有文件系统时是否由 fs_init 格式化
     partition prim_parts[4];        // 主分区顶多是 4 个
     partition logic_parts[8];       // 逻辑分区数量无限, 但总得有个支持的上限, 那就支持 8 个
 } disk;
@@ -36,9 +46,22 @@ typedef struct ide_channel {
     char name[8];           // 本 ata 通道名称 
     uint16_t port_base;     // 本通道的起始端口号
     uint8_t irq_no;         // 本通道所用的中断号
-    lock lock;              // 通道锁
     bool expecting_intr;    // 表示等待硬盘的中断
-    semaphore disk_done;    // 用于阻塞、唤醒驱动程序
+    semaphore disk_done;    // 用于阻塞、唤醒 identify 等直接发出的命令
+    bool wait_timeout;      // 直接发出的命令等待超时
+    uint32_t spin_limit;    // ide_wait 睡眠前自旋的次数, 随命令的完成快慢调整
+    uint8_t cmd;            // 最近发出的命令, 用于统计延迟
+    uint64_t cmd_tsc;       // 发出命令时的 tsc
+    blk_queue queue;        // 本通道的请求队列, 两块硬盘共用
+    bool dma_active;        // 正在传输的一批请求是否使用 dma
+    bool xfer_error;        // 启动传输时已经出错
+    blk_request* cur;       // 正在传输的一批请求, 为 NULL 表示通道空闲
+    blk_request* pio_req;   // PIO 传输的游标: 当前请求
+    uint32_t pio_sec;       // 当前请求中已传输的扇区数
+    uint32_t pio_left;      // 这批请求中还未传输的扇区数
+    uint16_t pio_buf[256];  // PIO 传输一个扇区的中转缓冲区
+    uint16_t bm_base;       // 总线主控寄存器基址, 为 0 表示只能用 PIO
+    struct prd_entry* prdt; // 本通道的 PRD 表
     disk devices[2];        // 一个通道上连接两个硬盘, 一主一从
 } ide_channel;
 
@@ -49,6 +72,8 @@ extern ide_channel channels[];
 extern list partition_list;
 
 void intr_hd_handler(uint8_t irq_no);
+void disk_partition_scan(disk* hd);
+void ide_stat_print(void);
 void ide_read(disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
 void ide_write(disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
 
@@ -0,0 +1,13 @@
+#ifndef __DEVICE_IOAPIC_H__
+#define __DEVICE_IOAPIC_H__
+
+#include "stdint.h"
+#include "global.h"
+
+
+bool ioapic_available(void);
+void ioapic_init(void);
+void ioapic_route(uint8_t irq, uint8_t vector, uint8_t apic_id);
+void ioapic_mask(uint8_t irq);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef __DEVICE_LAPIC_H__
+#define __DEVICE_LAPIC_H__
+
+#include "stdint.h"
+#include "global.h"
+
+#define LAPIC_SPURIOUS_VEC  0x3f    // 伪中断向量, 不需要 EOI
+
+
+bool lapic_available(void);
+void lapic_init(void);
+uint8_t lapic_id(void);
+void lapic_eoi(void);
+
+void lapic_timer_calibrate(void);
+void lapic_timer_start(uint8_t vector);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef __DEVICE_PCI_H__
+#define __DEVICE_PCI_H__
+
+#include "stdint.h"
+#include "global.h"
+
+#define PCI_MAX_DEVS    32      // 最多记录的 pci 功能数
+
+// 配置空间中的常用偏移
+#define PCI_VENDOR_ID   0x00
+#define PCI_COMMAND     0x04
+#define PCI_CLASS_REV   0x08
+#define PCI_HEADER_TYPE 0x0c
+#define PCI_BAR(n)      (0x10 + (n) * 4)
+#define PCI_INTR_LINE   0x3c
+
+// command 寄存器的一些关键位
+#define PCI_CMD_IO          0x1     // 响应 io 空间访问
+#define PCI_CMD_MEM         0x2     // 响应内存空间访问
+#define PCI_CMD_BUS_MASTER  0x4     // 允许设备发起总线主控访问
+
+#define PCI_CLASS_STORAGE   0x01
+#define PCI_SUBCLASS_IDE    0x01
+#define PCI_SUBCLASS_SATA   0x06
+
+
+// 一个 pci 功能
+typedef struct pci_dev {
+    uint8_t bus;
+    uint8_t dev;
+    uint8_t func;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+    uint8_t irq_line;
+} pci_dev;
+
+
+void pci_init(void);
+uint32_t pci_read(pci_dev *pdev, uint8_t offset);
+void pci_write(pci_dev *pdev, uint8_t offset, uint32_t val);
+pci_dev *pci_find_class(uint8_t class_code, uint8_t subclass);
+pci_dev *pci_find_device(uint16_t vendor_id, uint16_t device_id, uint32_t nth);
+void pci_enable_bus_master(pci_dev *pdev);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef __DEVICE_RAID_H__
+#define __DEVICE_RAID_H__
+
+#include "stdint.h"
+#include "global.h"
+
+#define RAID_MAX_MEMBERS    4
+#define RAID_CHUNK_SECTORS  128     // 条带的块大小 64KB, raid1 的读也按此拆分后分散到各镜像
+
+/**
+ * 阵列配置, 可在 defines.mk 中定义, 如 md0=raid0:sdb5,sdd5/md1=raid1:sdb6,sdd6.
+ * 成员放在不同 ide 通道上时才能并行传输. 默认不组装阵列
+ */
+#ifndef RAID_CONF
+#define RAID_CONF ""
+#endif
+
+
+struct disk;
+
+
+typedef enum raid_level {
+    RAID0,      // 条带, 容量为各成员之和
+    RAID1       // 镜像, 写所有成员, 读任选其一
+} raid_level;
+
+
+// 虚拟 lba 映射到的成员硬盘上的位置
+typedef struct raid_target {
+    struct disk *hd;
+    uint32_t lba;
+    uint32_t member;    // 成员序号, 用于统计
+} raid_target;
+
+
+void raid_init(void);
+uint32_t raid_map(struct disk *hd, uint32_t lba, uint32_t *sec_cnt, bool is_write, raid_target *targets);
+void raid_account(struct disk *hd, raid_target *targets, uint32_t cnt, uint32_t sec_cnt, bool is_write);
+void raid_stat_print(void);
+
+#endif
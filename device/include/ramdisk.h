@@ -0,0 +1,15 @@
+#ifndef __DEVICE_RAMDISK_H__
+#define __DEVICE_RAMDISK_H__
+
+#include "stdint.h"
+#include "global.h"
+
+// 内存盘的扇区数, 默认 2MB, 可在 defines.mk 中覆盖, 为 0 表示不创建
+#ifndef RAMDISK_SECTORS
+#define RAMDISK_SECTORS 4096
+#endif
+
+
+void ramdisk_init(uint32_t sectors);
+
+#endif
@@ -1,9 +1,28 @@
 #ifndef __DEVICE_TIME_H__
 #define __DEVICE_TIME_H__
 
+#include "list.h"
 #include "stdint.h"
 
+
+// 内核定时器, 到期后在软中断中以开中断状态调用 function, 不能阻塞
+typedef struct timer_list {
+    uint32_t expires;               // 到期时的 ticks
+    void (*function)(void *data);
+    void *data;
+    list_elem timer_tag;
+    bool active;                    // 是否在定时器队列中
+} timer_list;
+
+
+extern uint32_t ticks;
+
+uint32_t msecs_to_ticks(uint32_t m_seconds);
+void add_timer(timer_list *timer);
+void del_timer(timer_list *timer);
+
 void mtime_sleep(uint32_t m_seconds);
+void msleep(uint32_t m_seconds);
 void timer_init(void);
 
 #endif
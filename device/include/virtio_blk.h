@@ -0,0 +1,10 @@
+#ifndef __DEVICE_VIRTIO_BLK_H__
+#define __DEVICE_VIRTIO_BLK_H__
+
+#include "stdint.h"
+#include "global.h"
+
+
+void virtio_blk_init(void);
+
+#endif
@@ -0,0 +1,77 @@
+#include "mp.h"
+#include "print.h"
+#include "debug.h"
+#include "memory.h"
+
+#include "ioapic.h"
+
+#define IOAPIC_REGSEL   0x00    // 寄存器选择
+#define IOAPIC_WIN      0x10    // 数据窗口
+
+#define IOAPIC_REG_VER  0x01
+#define IOAPIC_REG_REDTBL(pin) (0x10 + (pin) * 2)   // 每个引脚的重定向表项占两个 32 位寄存器
+
+#define REDTBL_POL_LOW      (1 << 13)
+#define REDTBL_TRIG_LEVEL   (1 << 15)
+#define REDTBL_MASKED       (1 << 16)
+
+
+static volatile uint32_t *ioapic;   // 映射后的寄存器基址
+static uint8_t max_pin;             // 最大的重定向表项编号
+
+
+static uint32_t ioapic_read(uint8_t reg) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    return ioapic[IOAPIC_WIN / 4];
+}
+
+
+static void ioapic_write(uint8_t reg, uint32_t val) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    ioapic[IOAPIC_WIN / 4] = val;
+}
+
+
+bool ioapic_available(void) {
+    return ioapic != NULL;
+}
+
+
+// 映射 IOAPIC 并屏蔽所有引脚
+void ioapic_init(void) {
+    if (!mp.has_ioapic) {
+        return;
+    }
+    ioapic = ioremap(mp.ioapic_addr, PG_SIZE);
+    max_pin = (ioapic_read(IOAPIC_REG_VER) >> 16) & 0xff;
+    for (uint8_t pin = 0; pin <= max_pin; ++pin) {
+        ioapic_write(IOAPIC_REG_REDTBL(pin), REDTBL_MASKED);
+        ioapic_write(IOAPIC_REG_REDTBL(pin) + 1, 0);
+    }
+}
+
+
+// 把 ISA 中断 irq 以固定投递方式送往 apic_id 对应 cpu 的 vector 号中断
+void ioapic_route(uint8_t irq, uint8_t vector, uint8_t apic_id) {
+    ASSERT(ioapic != NULL && irq < ISA_IRQ_CNT);
+    uint8_t pin = mp.irq_pin[irq];
+    ASSERT(pin <= max_pin);
+
+    uint32_t low = vector;
+    if (mp.irq_flags[irq] & MP_IRQ_POL_LOW) {
+        low |= REDTBL_POL_LOW;
+    }
+    if (mp.irq_flags[irq] & MP_IRQ_TRIG_LEVEL) {
+        low |= REDTBL_TRIG_LEVEL;
+    }
+    // 先写高 32 位的目标 cpu, 最后写低 32 位时才解除屏蔽
+    ioapic_write(IOAPIC_REG_REDTBL(pin) + 1, (uint32_t)apic_id << 24);
+    ioapic_write(IOAPIC_REG_REDTBL(pin), low);
+}
+
+
+void ioapic_mask(uint8_t irq) {
+    ASSERT(ioapic != NULL && irq < ISA_IRQ_CNT);
+    uint8_t pin = mp.irq_pin[irq];
+    ioapic_write(IOAPIC_REG_REDTBL(pin), ioapic_read(IOAPIC_REG_REDTBL(pin)) | REDTBL_MASKED);
+}
@@ -2,11 +2,13 @@
 #include "print.h"
 #include "global.h"
 #include "ioqueue.h"
+#include "softirq.h"
 #include "interrupt.h"
 
 #include "keyboard.h"
 
 #define KBD_BUF_PORT 0x60   // 键盘 buffer 寄存器端口号为 0x60
+#define SCANCODE_BUF_SIZE 32    // 上半部暂存扫描码的缓冲区大小
 
 // 用转义字符定义部分控制字符
 #define esc         '\033'  // 八进制表示字符, 也可以用十六进制 '\x1b'
@@ -39,6 +41,10 @@
 ioqueue kbd_buf;
 static bool ctrl_status, shift_status, alt_status, caps_lock_status, ext_scancode;
 
+// 上半部只把扫描码放进此缓冲区, 由软中断解码. 仅在关中断下访问
+static uint8_t scancode_buf[SCANCODE_BUF_SIZE];
+static uint32_t scancode_head, scancode_tail;
+
 // 以通码 make_code 为索引的二维数组
 static char keymap[][2] = {
 /* 扫描码   无 shift  有 shift */
@@ -106,13 +112,23 @@ static char keymap[][2] = {
 };
 
 
-static void intr_keyboard_handler(void) {
+// 将字符放入 kbd_buf. 下半部不能阻塞, 缓冲区满时丢弃该字符
+static void kbd_putchar(char byte) {
+    intr_status old_status = intr_disable();
+    if (!ioq_full(&kbd_buf)) {
+        ioq_putchar(&kbd_buf, byte);
+    }
+    intr_set_status(old_status);
+}
+
+
+// 解码一个扫描码, 在开中断的软中断上下文中执行
+static void scancode_decode(uint16_t scancode) {
     bool ctrl_down_last = ctrl_status;
     bool shift_down_last = shift_status;
     bool caps_lock_last = caps_lock_status;
 
     bool break_code;
-    uint16_t scancode = inb(KBD_BUF_PORT);
 
     // 若扫描码是 e0 开头的, 表示此键的按下将产生多个扫描码,
     // 所以马上结束此次中断处理函数, 等待下一个扫描码进来
@@ -197,7 +213,7 @@ static void intr_keyboard_handler(void) {
             else if (ctrl_down_last && cur_char == 'l') {
                 cur_char -= 'a';    // 清空屏幕的快捷方式
             }
-            ioq_putchar(&kbd_buf, cur_char);
+            kbd_putchar(cur_char);
             return;
         }
 
@@ -220,9 +236,40 @@ static void intr_keyboard_handler(void) {
 }
 
 
+// 键盘软中断: 解码上半部收集的所有扫描码
+static void keyboard_do_softirq(void) {
+    while (1) {
+        intr_status old_status = intr_disable();
+        if (scancode_tail == scancode_head) {
+            intr_set_status(old_status);
+            break;
+        }
+        uint8_t scancode = scancode_buf[scancode_tail];
+        scancode_tail = (scancode_tail + 1) % SCANCODE_BUF_SIZE;
+        intr_set_status(old_status);
+
+        scancode_decode(scancode);
+    }
+}
+
+
+// 上半部: 读出扫描码使键盘控制器可以继续工作, 解码留给软中断
+static void intr_keyboard_handler(void) {
+    uint8_t scancode = inb(KBD_BUF_PORT);
+    uint32_t next_head = (scancode_head + 1) % SCANCODE_BUF_SIZE;
+    if (next_head != scancode_tail) {   // 缓冲区满则丢弃
+        scancode_buf[scancode_head] = scancode;
+        scancode_head = next_head;
+    }
+    raise_softirq(KBD_SOFTIRQ);
+}
+
+
 void keyboard_init() {
     put_str("\nkeyboard init start\n");
     ioqueue_init(&kbd_buf);
+    lock_register(&kbd_buf.lock, "kbd_buf");
+    open_softirq(KBD_SOFTIRQ, keyboard_do_softirq);
     register_handler(0x21, intr_keyboard_handler);
     put_str("keyboard init done\n");
 }
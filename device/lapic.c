@@ -0,0 +1,126 @@
+#include "mp.h"
+#include "print.h"
+#include "debug.h"
+#include "timer.h"
+#include "memory.h"
+#include "interrupt.h"
+
+#include "lapic.h"
+
+// local APIC 寄存器偏移, 每个寄存器按 16 字节对齐, 只能按 32 位访问
+#define LAPIC_ID        0x020
+#define LAPIC_VER       0x030
+#define LAPIC_TPR       0x080   // 任务优先级
+#define LAPIC_EOI       0x0b0
+#define LAPIC_SVR       0x0f0   // 伪中断向量寄存器, bit 8 为 APIC 软件使能位
+#define LAPIC_ESR       0x280   // 错误状态
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_ERR   0x370
+#define LAPIC_TIMER_ICR 0x380   // 定时器初始计数
+#define LAPIC_TIMER_CCR 0x390   // 定时器当前计数
+#define LAPIC_TIMER_DCR 0x3e0   // 定时器分频
+
+#define SVR_ENABLE      (1 << 8)
+#define LVT_MASKED      (1 << 16)
+#define LVT_TIMER_PERIODIC (1 << 17)
+
+#define TIMER_DIV_16    0x3
+#define CALIBRATE_TICKS 10      // 用 10 个 PIT tick (100ms) 校准定时器
+
+#define CPUID_EDX_APIC  (1 << 9)
+
+
+static volatile uint32_t *lapic;    // 映射后的寄存器基址, 为 NULL 表示未启用
+static uint32_t timer_count;        // 定时器在一个 tick 内的计数, 由 PIT 校准
+
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+
+static inline void lapic_write(uint32_t reg, uint32_t val) {
+    lapic[reg / 4] = val;
+    (void)lapic[LAPIC_ID / 4];  // 读一次使写操作生效
+}
+
+
+static bool cpu_has_apic(void) {
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+    return (edx & CPUID_EDX_APIC) != 0;
+}
+
+
+bool lapic_available(void) {
+    return lapic != NULL;
+}
+
+
+// 映射并初始化 BSP 的 local APIC, 没有 MP 配置表或 cpu 不支持 APIC 时什么也不做
+void lapic_init(void) {
+    if (!mp.found || !cpu_has_apic()) {
+        return;
+    }
+    lapic = ioremap(mp.lapic_addr, PG_SIZE);
+
+    // 软件使能 APIC 并设置伪中断向量
+    lapic_write(LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VEC);
+
+    // BSP 的 LINT0 由 BIOS 设为 ExtINT, 8259A 的中断经由它到达, 保持不动
+    lapic_write(LAPIC_LVT_ERR, LVT_MASKED);
+
+    // 清除错误状态, 须连续写两次
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+
+    lapic_write(LAPIC_TPR, 0);  // 接收所有优先级的中断
+}
+
+
+uint8_t lapic_id(void) {
+    if (lapic == NULL) {
+        return 0;
+    }
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+
+void lapic_eoi(void) {
+    if (lapic != NULL) {
+        lapic_write(LAPIC_EOI, 0);
+    }
+}
+
+
+/**
+ * 以 PIT 产生的 ticks 为基准测出定时器一个 tick 的计数.
+ * 须在 BSP 上开中断且 PIT 中断仍经 8259A 到达时调用
+ */
+void lapic_timer_calibrate(void) {
+    ASSERT(lapic != NULL && intr_get_status() == INTR_ON);
+    volatile uint32_t *pticks = &ticks;
+
+    lapic_write(LAPIC_TIMER_DCR, TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+
+    // 从 tick 边界开始计时
+    uint32_t start = *pticks;
+    while (*pticks == start);
+    lapic_write(LAPIC_TIMER_ICR, 0xffffffff);
+    start = *pticks;
+    while (*pticks - start < CALIBRATE_TICKS);
+    uint32_t elapsed = 0xffffffff - lapic_read(LAPIC_TIMER_CCR);
+    lapic_write(LAPIC_TIMER_ICR, 0);
+
+    timer_count = elapsed / CALIBRATE_TICKS;
+}
+
+
+// 启动周期定时器, 每个 tick 产生一次 vector 号中断
+void lapic_timer_start(uint8_t vector) {
+    ASSERT(lapic != NULL && timer_count > 0);
+    lapic_write(LAPIC_TIMER_DCR, TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_TIMER_PERIODIC | vector);
+    lapic_write(LAPIC_TIMER_ICR, timer_count);
+}
@@ -0,0 +1,108 @@
+#include "io.h"
+#include "debug.h"
+#include "stdio_kernel.h"
+
+#include "pci.h"
+
+#define PCI_CONFIG_ADDR 0xcf8   // 配置地址端口
+#define PCI_CONFIG_DATA 0xcfc   // 配置数据端口
+
+static pci_dev pci_devs[PCI_MAX_DEVS];  // 枚举到的所有 pci 功能
+static uint8_t pci_dev_cnt;
+
+
+// 以配置机制 1 读取 bus:dev.func 配置空间 offset 处的双字
+static uint32_t pci_config_read(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset) {
+    uint32_t addr = 0x80000000 | (bus << 16) | (dev << 11) | (func << 8) | (offset & 0xfc);
+    outl(PCI_CONFIG_ADDR, addr);
+    return inl(PCI_CONFIG_DATA);
+}
+
+
+static void pci_config_write(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset, uint32_t val) {
+    uint32_t addr = 0x80000000 | (bus << 16) | (dev << 11) | (func << 8) | (offset & 0xfc);
+    outl(PCI_CONFIG_ADDR, addr);
+    outl(PCI_CONFIG_DATA, val);
+}
+
+
+uint32_t pci_read(pci_dev *pdev, uint8_t offset) {
+    return pci_config_read(pdev->bus, pdev->dev, pdev->func, offset);
+}
+
+
+void pci_write(pci_dev *pdev, uint8_t offset, uint32_t val) {
+    pci_config_write(pdev->bus, pdev->dev, pdev->func, offset, val);
+}
+
+
+// 找到第一个类别匹配的 pci 功能, 没有则返回 NULL
+pci_dev *pci_find_class(uint8_t class_code, uint8_t subclass) {
+    for (uint8_t idx = 0; idx < pci_dev_cnt; idx++) {
+        if (pci_devs[idx].class_code == class_code && pci_devs[idx].subclass == subclass) {
+            return &pci_devs[idx];
+        }
+    }
+    return NULL;
+}
+
+
+// 找到第 nth 个 (从 0 开始) 厂商和设备号匹配的 pci 功能, 没有则返回 NULL
+pci_dev *pci_find_device(uint16_t vendor_id, uint16_t device_id, uint32_t nth) {
+    for (uint8_t idx = 0; idx < pci_dev_cnt; idx++) {
+        if (pci_devs[idx].vendor_id == vendor_id && pci_devs[idx].device_id == device_id && nth-- == 0) {
+            return &pci_devs[idx];
+        }
+    }
+    return NULL;
+}
+
+
+// 打开设备的 io 空间、内存空间访问和总线主控
+void pci_enable_bus_master(pci_dev *pdev) {
+    uint32_t cmd = pci_read(pdev, PCI_COMMAND);
+    cmd |= PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_BUS_MASTER;
+    pci_write(pdev, PCI_COMMAND, cmd & 0xffff); // 高 16 位是状态寄存器, 写 1 会清除状态位
+}
+
+
+static void pci_probe(uint8_t bus, uint8_t dev, uint8_t func) {
+    uint32_t id = pci_config_read(bus, dev, func, PCI_VENDOR_ID);
+    if ((id & 0xffff) == 0xffff || pci_dev_cnt >= PCI_MAX_DEVS) {
+        return;
+    }
+    uint32_t class_rev = pci_config_read(bus, dev, func, PCI_CLASS_REV);
+    pci_dev *pdev = &pci_devs[pci_dev_cnt++];
+    pdev->bus = bus;
+    pdev->dev = dev;
+    pdev->func = func;
+    pdev->vendor_id = id & 0xffff;
+    pdev->device_id = id >> 16;
+    pdev->class_code = class_rev >> 24;
+    pdev->subclass = (class_rev >> 16) & 0xff;
+    pdev->prog_if = (class_rev >> 8) & 0xff;
+    pdev->irq_line = pci_config_read(bus, dev, func, PCI_INTR_LINE) & 0xff;
+    printk("    %d:%d.%d vendor 0x%x device 0x%x class 0x%x:0x%x\n",
+           bus, dev, func, pdev->vendor_id, pdev->device_id, pdev->class_code, pdev->subclass);
+}
+
+
+// 暴力扫描所有总线上的设备, 多功能设备逐个功能探测
+void pci_init(void) {
+    printk("pci_init start\n");
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint8_t dev = 0; dev < 32; dev++) {
+            if ((pci_config_read(bus, dev, 0, PCI_VENDOR_ID) & 0xffff) == 0xffff) {
+                continue;
+            }
+            pci_probe(bus, dev, 0);
+            uint8_t header = (pci_config_read(bus, dev, 0, PCI_HEADER_TYPE) >> 16) & 0xff;
+            if (header & 0x80) {
+                for (uint8_t func = 1; func < 8; func++) {
+                    pci_probe(bus, dev, func);
+                }
+            }
+        }
+    }
+    printk("pci_init done\n");
+}
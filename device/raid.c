@@ -0,0 +1,258 @@
+#include "debug.h"
+#include "string.h"
+#include "interrupt.h"
+#include "stdio_kernel.h"
+#include "ide.h"
+
+#include "raid.h"
+
+#define RAID_MAX_DEVS   2
+
+
+// 由若干物理分区组成的虚拟硬盘, 其上只有一个覆盖整盘的分区
+typedef struct raid_dev {
+    raid_level level;
+    uint32_t member_cnt;
+    partition *members[RAID_MAX_MEMBERS];
+    uint32_t member_secs;       // 每个成员用到的扇区数, raid0 按块对齐
+    uint32_t last_read[RAID_MAX_MEMBERS];   // 各成员上一次读结束的位置, 用于识别顺序读
+    uint32_t read_secs[RAID_MAX_MEMBERS];   // 各成员读写的扇区数
+    uint32_t write_secs[RAID_MAX_MEMBERS];
+    disk hd;
+    partition part;
+} raid_dev;
+
+
+// 从 RAID_CONF 中解析出的一个阵列
+typedef struct raid_conf {
+    char name[8];
+    raid_level level;
+    uint32_t member_cnt;
+    char members[RAID_MAX_MEMBERS][8];
+} raid_conf;
+
+static raid_dev raid_devs[RAID_MAX_DEVS];
+static uint8_t raid_cnt;
+
+
+static bool find_partition(list_elem *pelem, int arg) {
+    partition *part = elem2entry(partition, part_tag, pelem);
+    return !strcmp(part->name, (char *)arg);
+}
+
+
+/**
+ * raid1 读时挑选成员: 正好接着某成员上次读的位置则用它, 保持顺序读;
+ * 否则选队列中请求最少的, 一样多时选磁头离得近的. 大的读被按块拆开, 会交替落到各镜像上
+ */
+static uint32_t raid1_pick(raid_dev *dev, uint32_t lba) {
+    uint32_t best = 0, best_depth = 0xffffffff, best_dist = 0xffffffff;
+    for (uint32_t idx = 0; idx < dev->member_cnt; idx++) {
+        partition *part = dev->members[idx];
+        if (dev->last_read[idx] == lba) {
+            return idx;
+        }
+        blk_queue *q = part->my_disk->queue;
+        uint32_t plba = part->start_lba + lba;
+        uint32_t dist = q->head_lba > plba ? q->head_lba - plba : plba - q->head_lba;
+        if (q->depth < best_depth || (q->depth == best_depth && dist < best_dist)) {
+            best = idx;
+            best_depth = q->depth;
+            best_dist = dist;
+        }
+    }
+    return best;
+}
+
+
+/**
+ * 把虚拟硬盘 hd 上从 lba 开始的传输映射到成员上, 返回目标数, 写入 targets.
+ * *sec_cnt 被截短到不跨块的长度. 调用者可能按成员队列的限制再截短,
+ * 最后以实际长度调用 raid_account, 然后推进并映射余下部分.
+ * raid0 和 raid1 的读只有一个目标, raid1 的写每个成员一个
+ */
+uint32_t raid_map(struct disk *hd, uint32_t lba, uint32_t *sec_cnt, bool is_write, raid_target *targets) {
+    raid_dev *dev = hd->raid;
+    uint32_t off = lba % RAID_CHUNK_SECTORS;
+    if (*sec_cnt > RAID_CHUNK_SECTORS - off) {
+        *sec_cnt = RAID_CHUNK_SECTORS - off;
+    }
+
+    intr_status old_status = intr_disable();
+    uint32_t cnt = 1;
+    if (dev->level == RAID0) {
+        uint32_t chunk = lba / RAID_CHUNK_SECTORS;
+        uint32_t idx = chunk % dev->member_cnt;
+        targets[0].member = idx;
+        targets[0].lba = dev->members[idx]->start_lba + chunk / dev->member_cnt * RAID_CHUNK_SECTORS + off;
+    }
+    else if (is_write) {
+        cnt = dev->member_cnt;
+        for (uint32_t idx = 0; idx < cnt; idx++) {
+            targets[idx].member = idx;
+            targets[idx].lba = dev->members[idx]->start_lba + lba;
+        }
+    }
+    else {
+        uint32_t idx = raid1_pick(dev, lba);
+        targets[0].member = idx;
+        targets[0].lba = dev->members[idx]->start_lba + lba;
+    }
+    for (uint32_t idx = 0; idx < cnt; idx++) {
+        targets[idx].hd = dev->members[targets[idx].member]->my_disk;
+    }
+    intr_set_status(old_status);
+    return cnt;
+}
+
+
+// 记录映射到 targets 上的一次实际传输, 顺序读的判断依赖 last_read 与真正提交的长度一致
+void raid_account(struct disk *hd, raid_target *targets, uint32_t cnt, uint32_t sec_cnt, bool is_write) {
+    raid_dev *dev = hd->raid;
+    intr_status old_status = intr_disable();
+    for (uint32_t idx = 0; idx < cnt; idx++) {
+        uint32_t member = targets[idx].member;
+        if (is_write) {
+            dev->write_secs[member] += sec_cnt;
+        }
+        else {
+            dev->read_secs[member] += sec_cnt;
+            dev->last_read[member] = targets[idx].lba - dev->members[member]->start_lba + sec_cnt;
+        }
+    }
+    intr_set_status(old_status);
+}
+
+
+// 按配置组装一个阵列, 成员从 partition_list 中摘下, 换成阵列的分区
+static void raid_assemble(raid_conf *conf) {
+    raid_dev *dev = &raid_devs[raid_cnt];
+    dev->level = conf->level;
+    dev->member_cnt = 0;
+    dev->member_secs = 0xffffffff;
+    for (uint32_t idx = 0; idx < conf->member_cnt; idx++) {
+        list_elem *elem = list_traversal(&partition_list, find_partition, (int)conf->members[idx]);
+        if (elem == NULL) {
+            printk("    %s: member %s not found, skip\n", conf->name, conf->members[idx]);
+            return;
+        }
+        partition *part = elem2entry(partition, part_tag, elem);
+        dev->members[dev->member_cnt++] = part;
+        if (part->sec_cnt < dev->member_secs) {
+            dev->member_secs = part->sec_cnt;
+        }
+    }
+    if (dev->member_cnt < 2) {
+        return;
+    }
+
+    disk *hd = &dev->hd;
+    strcpy(hd->name, conf->name);
+    hd->raid = dev;
+    hd->queue = NULL;
+    hd->auto_format = true;
+    hd->max_sectors = RAID_CHUNK_SECTORS;
+    if (dev->level == RAID0) {
+        dev->member_secs -= dev->member_secs % RAID_CHUNK_SECTORS;
+        hd->sectors = dev->member_secs * dev->member_cnt;
+    }
+    else {
+        hd->sectors = dev->member_secs;
+    }
+
+    printk("    %s: raid%d, %d sectors, members", hd->name, dev->level == RAID0 ? 0 : 1, hd->sectors);
+    for (uint32_t idx = 0; idx < dev->member_cnt; idx++) {
+        list_remove(&dev->members[idx]->part_tag);
+        dev->last_read[idx] = 0xffffffff;
+        printk(" %s", dev->members[idx]->name);
+    }
+    printk("\n");
+
+    partition *part = &dev->part;
+    part->start_lba = 0;
+    part->sec_cnt = hd->sectors;
+    part->my_disk = hd;
+    strcpy(part->name, hd->name);
+    list_append(&partition_list, &part->part_tag);
+    raid_cnt++;
+}
+
+
+// 从 *pos 读出一个以 stops 中的字符或字符串结尾为界的名字, 为空或超出 size 时返回 false
+static bool conf_token(const char **pos, char *buf, uint32_t size, const char *stops) {
+    uint32_t len = 0;
+    while (**pos != '\0' && strchr(stops, **pos) == NULL) {
+        if (len + 1 >= size) {
+            return false;
+        }
+        buf[len++] = *(*pos)++;
+    }
+    buf[len] = '\0';
+    return len > 0;
+}
+
+
+// 解析一项 "名字=raid级别:成员,成员", 各项以 '/' 分隔, 成功时 *pos 指向下一项
+static bool raid_parse(const char **pos, raid_conf *conf) {
+    char level[8];
+    if (!conf_token(pos, conf->name, sizeof(conf->name), "=") || **pos != '=') {
+        return false;
+    }
+    (*pos)++;
+    if (!conf_token(pos, level, sizeof(level), ":") || **pos != ':') {
+        return false;
+    }
+    (*pos)++;
+    if (!strcmp(level, "raid0")) {
+        conf->level = RAID0;
+    }
+    else if (!strcmp(level, "raid1")) {
+        conf->level = RAID1;
+    }
+    else {
+        return false;
+    }
+
+    conf->member_cnt = 0;
+    while (conf->member_cnt < RAID_MAX_MEMBERS &&
+           conf_token(pos, conf->members[conf->member_cnt], sizeof(conf->members[0]), ",/")) {
+        conf->member_cnt++;
+        if (**pos != ',') {
+            break;
+        }
+        (*pos)++;
+    }
+    if (**pos == '/') {
+        (*pos)++;
+        return true;
+    }
+    return **pos == '\0';
+}
+
+
+void raid_init(void) {
+    printk("\nraid_init start\n");
+    const char *pos = RAID_CONF;
+    while (*pos != '\0' && raid_cnt < RAID_MAX_DEVS) {
+        raid_conf conf;
+        if (!raid_parse(&pos, &conf)) {
+            printk("    bad RAID_CONF near \"%s\"\n", pos);
+            break;
+        }
+        raid_assemble(&conf);
+    }
+    printk("raid_init done\n");
+}
+
+
+void raid_stat_print(void) {
+    printk("raid devices:\n");
+    printk("    NAME   LEVEL   MEMBER   READ_SECS   WRITE_SECS\n");
+    for (uint8_t dev_idx = 0; dev_idx < raid_cnt; dev_idx++) {
+        raid_dev *dev = &raid_devs[dev_idx];
+        for (uint32_t idx = 0; idx < dev->member_cnt; idx++) {
+            printk("    %s   raid%d   %s   %d   %d\n", dev->hd.name, dev->level == RAID0 ? 0 : 1,
+                   dev->members[idx]->name, dev->read_secs[idx], dev->write_secs[idx]);
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#include "debug.h"
+#include "string.h"
+#include "memory.h"
+#include "stdio_kernel.h"
+#include "ide.h"
+
+#include "ramdisk.h"
+
+
+// 由内核页构成的内存盘, 其上只有一个覆盖整盘的分区
+typedef struct ramdisk {
+    uint8_t *data;
+    disk hd;
+    partition part;
+} ramdisk;
+
+
+static ramdisk ram0;
+
+#ifdef RAMDISK_IMAGE
+// 由 objcopy 把 $(RAMDISK_IMAGE) 嵌入内核时生成的符号
+extern char _binary_ramdisk_img_start[], _binary_ramdisk_img_end[];
+#endif
+
+
+// 读写直接拷贝内存, 不经请求队列, 在调用者的上下文中同步完成
+static bool ramdisk_rw(disk *hd, uint32_t lba, void *buf, uint32_t sec_cnt, bool is_write) {
+    ramdisk *rd = elem2entry(ramdisk, hd, hd);
+    if (lba + sec_cnt > hd->sectors || lba + sec_cnt < lba) {
+        return false;
+    }
+    if (is_write) {
+        memcpy(rd->data + lba * 512, buf, sec_cnt * 512);
+    }
+    else {
+        memcpy(buf, rd->data + lba * 512, sec_cnt * 512);
+    }
+    return true;
+}
+
+
+/**
+ * 创建 sectors 个扇区的内存盘 ram0 并加入 partition_list, 由 fs_init 格式化和挂载.
+ * 内核中嵌有镜像时先把它拷进来, 镜像上已有文件系统便不会再被格式化
+ */
+void ramdisk_init(uint32_t sectors) {
+    printk("\nramdisk_init start\n");
+    if (sectors == 0) {
+        printk("ramdisk_init done, disabled\n");
+        return;
+    }
+    ramdisk *rd = &ram0;
+    rd->data = get_kernel_pages(DIV_ROUND_UP(sectors * 512, PG_SIZE));
+    if (rd->data == NULL) {
+        printk("ramdisk_init done, alloc %d sectors failed\n", sectors);
+        return;
+    }
+
+#ifdef RAMDISK_IMAGE
+    uint32_t image_size = _binary_ramdisk_img_end - _binary_ramdisk_img_start;
+    if (image_size > sectors * 512) {
+        printk("    ramdisk image %d bytes truncated\n", image_size);
+        image_size = sectors * 512;
+    }
+    memcpy(rd->data, _binary_ramdisk_img_start, image_size);
+    printk("    preloaded %d bytes from embedded image\n", image_size);
+#endif
+
+    disk *hd = &rd->hd;
+    strcpy(hd->name, "ram0");
+    hd->queue = NULL;
+    hd->direct = ramdisk_rw;
+    hd->auto_format = true;
+    hd->sectors = sectors;
+    hd->max_sectors = sectors;
+
+    partition *part = &rd->part;
+    part->start_lba = 0;
+    part->sec_cnt = sectors;
+    part->my_disk = hd;
+    strcpy(part->name, hd->name);
+    list_append(&partition_list, &part->part_tag);
+    printk("    %s: %d sectors, CAPACITY: %dKB\n", hd->name, sectors, sectors / 2);
+    printk("ramdisk_init done\n");
+}
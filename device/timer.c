@@ -2,6 +2,8 @@
 #include "print.h"
 #include "debug.h"
 #include "thread.h"
+#include "softirq.h"
+#include "deadline.h"
 #include "interrupt.h"
 
 #include "timer.h"
@@ -19,6 +21,7 @@
 #define mil_seconds_per_intr (1000 / IRQ0_FREQUENCY)
 
 uint32_t ticks;     // ticks 是内核自中断开启以来总共的 ticks
+static list timer_head; // 按到期时间升序排列的内核定时器队列
 
 
 static void intr_timer_handler(void) {
@@ -28,7 +31,18 @@ static void intr_timer_handler(void) {
     cur_thread->elapsed_ticks++;
     ticks++;
 
-    if (cur_thread->ticks == 0) {
+    // 只检查队首, 到期定时器的回调留给软中断
+    if (!list_empty(&timer_head)) {
+        timer_list *first = elem2entry(timer_list, timer_tag, timer_head.head.next);
+        if ((int32_t)(ticks - first->expires) >= 0) {
+            raise_softirq(TIMER_SOFTIRQ);
+        }
+    }
+
+    if (cur_thread->policy == SCHED_DEADLINE) {
+        dl_task_tick(cur_thread);
+    }
+    else if (cur_thread->ticks == 0 || dl_should_preempt(cur_thread)) {
         schedule();
     }
     else {
@@ -54,6 +68,61 @@ static void frequency_set(
 }
 
 
+uint32_t msecs_to_ticks(uint32_t m_seconds) {
+    return DIV_ROUND_UP(m_seconds, mil_seconds_per_intr);
+}
+
+
+// 将 timer 按到期时间插入定时器队列
+void add_timer(timer_list *timer) {
+    intr_status old_status = intr_disable();
+    ASSERT(!timer->active);
+    list_elem *elem = timer_head.head.next;
+    while (elem != &timer_head.tail) {
+        timer_list *t = elem2entry(timer_list, timer_tag, elem);
+        if ((int32_t)(t->expires - timer->expires) > 0) {
+            break;
+        }
+        elem = elem->next;
+    }
+    list_insert_before(elem, &timer->timer_tag);
+    timer->active = true;
+    intr_set_status(old_status);
+}
+
+
+void del_timer(timer_list *timer) {
+    intr_status old_status = intr_disable();
+    if (timer->active) {
+        list_remove(&timer->timer_tag);
+        timer->active = false;
+    }
+    intr_set_status(old_status);
+}
+
+
+// 定时器软中断: 依次执行所有到期的定时器
+static void timer_do_softirq(void) {
+    while (1) {
+        intr_status old_status = intr_disable();
+        if (list_empty(&timer_head)) {
+            intr_set_status(old_status);
+            break;
+        }
+        timer_list *first = elem2entry(timer_list, timer_tag, timer_head.head.next);
+        if ((int32_t)(ticks - first->expires) < 0) {
+            intr_set_status(old_status);
+            break;
+        }
+        list_remove(&first->timer_tag);
+        first->active = false;
+        intr_set_status(old_status);
+
+        first->function(first->data);
+    }
+}
+
+
 static void ticks_to_sleep(uint32_t sleep_ticks) {
     uint32_t start_tick = ticks;
     while (ticks - start_tick < sleep_ticks) {
@@ -63,17 +132,40 @@ static void ticks_to_sleep(uint32_t sleep_ticks) {
 
 
 void mtime_sleep(uint32_t m_seconds) {
-    uint32_t sleep_ticks = DIV_ROUND_UP(m_seconds, mil_seconds_per_intr);
+    uint32_t sleep_ticks = msecs_to_ticks(m_seconds);
     ASSERT(sleep_ticks > 0);
     ticks_to_sleep(sleep_ticks);
 }
 
 
+static void sleep_timeout(void *data) {
+    thread_unblock((task_struct *)data);
+}
+
+
+// 阻塞睡眠, 与 mtime_sleep 不同, 睡眠期间不占用 cpu, 由定时器唤醒
+void msleep(uint32_t m_seconds) {
+    timer_list timer;
+    timer.expires = ticks + msecs_to_ticks(m_seconds);
+    timer.function = sleep_timeout;
+    timer.data = running_thread();
+    timer.active = false;
+
+    // 关中断到阻塞为止, 保证定时器不会在阻塞前到期
+    intr_status old_status = intr_disable();
+    add_timer(&timer);
+    thread_block(TASK_BLOCKED);
+    intr_set_status(old_status);
+}
+
+
 // 初始化 PIT 8253
 void timer_init() {
     put_str("\ntimer_init start\n");
     // 设置 8253 的定时周期, 也就是发中断的周期
     frequency_set(CONTRER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER_MODE, COUNTER0_VALUE);
+    list_init(&timer_head);
+    open_softirq(TIMER_SOFTIRQ, timer_do_softirq);
     register_handler(0x20, intr_timer_handler);
     put_str("timer_init done\n");
 }
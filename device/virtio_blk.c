@@ -0,0 +1,345 @@
+#include "io.h"
+#include "pci.h"
+#include "stdio.h"
+#include "debug.h"
+#include "string.h"
+#include "memory.h"
+#include "softirq.h"
+#include "interrupt.h"
+#include "stdio_kernel.h"
+#include "ide.h"
+
+#include "virtio_blk.h"
+
+#define VIRTIO_VENDOR_ID    0x1af4
+#define VIRTIO_BLK_DEV_ID   0x1001  // legacy (transitional) virtio-blk
+#define VBLK_MAX_DEVS       4
+#define VBLK_MAX_SECTORS    128     // 一批请求最多的扇区数
+#define VBLK_MAX_SEGS       (VBLK_MAX_SECTORS * 512 / PG_SIZE + 1)  // 不对齐的缓冲区最多跨越的页数
+#define VBLK_DESC_PER_REQ   (VBLK_MAX_SEGS + 2) // 每批请求固定占用的描述符: 请求头, 数据, 状态
+#define VBLK_MAX_INFLIGHT   16      // 同时在途的批数上限
+
+// legacy virtio-pci 的 io 空间寄存器, 位于 BAR0
+#define VIRTIO_PCI_HOST_FEATURES    0x00
+#define VIRTIO_PCI_GUEST_FEATURES   0x04
+#define VIRTIO_PCI_QUEUE_PFN        0x08
+#define VIRTIO_PCI_QUEUE_SIZE       0x0c
+#define VIRTIO_PCI_QUEUE_SEL        0x0e
+#define VIRTIO_PCI_QUEUE_NOTIFY     0x10
+#define VIRTIO_PCI_STATUS           0x12
+#define VIRTIO_PCI_ISR              0x13
+#define VIRTIO_PCI_CONFIG           0x14    // 设备配置区, virtio-blk 的前 8 字节是容量
+
+#define VIRTIO_STATUS_ACK           1
+#define VIRTIO_STATUS_DRIVER        2
+#define VIRTIO_STATUS_DRIVER_OK     4
+#define VIRTIO_STATUS_FAILED        128
+
+#define VRING_DESC_F_NEXT   1
+#define VRING_DESC_F_WRITE  2   // 设备写入这块缓冲区
+#define VRING_ALIGN         PG_SIZE
+
+#define VIRTIO_BLK_T_IN     0
+#define VIRTIO_BLK_T_OUT    1
+#define VIRTIO_BLK_S_OK     0
+
+// 禁止编译器越过此处重排内存访问, x86 的写操作本身不会乱序
+#define barrier() asm volatile ("" : : : "memory")
+
+
+struct vring_desc {
+    uint32_t addr;          // 缓冲区的物理地址, 高 32 位恒为 0
+    uint32_t addr_hi;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__ ((packed));
+
+
+// 驱动发给设备的可用环, ring 后面还有 used_event, 不使用
+struct vring_avail {
+    uint16_t flags;
+    volatile uint16_t idx;
+    uint16_t ring[];
+} __attribute__ ((packed));
+
+
+struct vring_used_elem {
+    uint32_t id;            // 描述符链头的下标
+    uint32_t len;           // 设备写入的字节数
+} __attribute__ ((packed));
+
+
+// 设备回给驱动的已用环
+struct vring_used {
+    uint16_t flags;
+    volatile uint16_t idx;
+    struct vring_used_elem ring[];
+} __attribute__ ((packed));
+
+
+// 请求头, 设备只读
+struct vblk_req_hdr {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__ ((packed));
+
+
+typedef struct vring_desc vring_desc;
+typedef struct vring_avail vring_avail;
+typedef struct vring_used vring_used;
+typedef struct vblk_req_hdr vblk_req_hdr;
+
+
+// 一个 virtio 块设备, 只用 0 号队列
+typedef struct virtio_blk {
+    uint16_t iobase;
+    uint16_t qsize;             // 队列的描述符数
+    vring_desc *desc;
+    vring_avail *avail;
+    vring_used *used;
+    uint16_t last_used;         // 下一个要处理的已用环下标
+    vblk_req_hdr *hdrs;         // 每个槽的请求头, 后面紧跟每个槽的状态字节
+    uint8_t *status;
+    blk_request *slot_req[VBLK_MAX_INFLIGHT];   // 每个槽上正在执行的一批请求
+    uint32_t slots;
+    bool pending;               // 上半部已收到完成中断, 等待下半部处理
+    disk hd;
+    blk_queue queue;
+} virtio_blk;
+
+
+static virtio_blk vblk_devs[VBLK_MAX_DEVS];
+static uint8_t vblk_cnt;
+
+
+/**
+ * 分配 pg_cnt 页物理上连续的内存, 设备按物理地址访问整个环.
+ * 内核物理内存池按位图顺序分配, 初始化时通常是连续的, 不连续则放弃该设备
+ */
+static void *alloc_contig_pages(uint32_t pg_cnt) {
+    uint32_t vaddr = (uint32_t)get_kernel_pages(pg_cnt);
+    if (vaddr == 0) {
+        return NULL;
+    }
+    uint32_t phy = addr_v2p(vaddr);
+    for (uint32_t idx = 1; idx < pg_cnt; idx++) {
+        if (addr_v2p(vaddr + idx * PG_SIZE) != phy + idx * PG_SIZE) {
+            mfree_page(PF_KERNEL, (void *)vaddr, pg_cnt);
+            return NULL;
+        }
+    }
+    return (void *)vaddr;
+}
+
+
+// 按 legacy 规范的布局分配并登记 0 号队列: 描述符表, 可用环, 按页对齐的已用环
+static bool vring_setup(virtio_blk *dev) {
+    outw(dev->iobase + VIRTIO_PCI_QUEUE_SEL, 0);
+    dev->qsize = inw(dev->iobase + VIRTIO_PCI_QUEUE_SIZE);
+    if (dev->qsize < VBLK_DESC_PER_REQ || inl(dev->iobase + VIRTIO_PCI_QUEUE_PFN) != 0) {
+        return false;
+    }
+
+    uint32_t avail_off = sizeof(vring_desc) * dev->qsize;
+    uint32_t used_off = (avail_off + sizeof(vring_avail) + 2 * (dev->qsize + 1) + VRING_ALIGN - 1) & ~(VRING_ALIGN - 1);
+    uint32_t size = used_off + sizeof(vring_used) + sizeof(struct vring_used_elem) * dev->qsize + 2;
+    uint8_t *ring = alloc_contig_pages(DIV_ROUND_UP(size, PG_SIZE));
+    dev->hdrs = get_kernel_pages(1);
+    if (ring == NULL || dev->hdrs == NULL) {
+        return false;
+    }
+    dev->desc = (vring_desc *)ring;
+    dev->avail = (vring_avail *)(ring + avail_off);
+    dev->used = (vring_used *)(ring + used_off);
+    dev->last_used = 0;
+
+    dev->slots = dev->qsize / VBLK_DESC_PER_REQ;
+    if (dev->slots > VBLK_MAX_INFLIGHT) {
+        dev->slots = VBLK_MAX_INFLIGHT;
+    }
+    dev->status = (uint8_t *)(dev->hdrs + dev->slots);
+    outl(dev->iobase + VIRTIO_PCI_QUEUE_PFN, addr_v2p((uint32_t)ring) / PG_SIZE);
+    return true;
+}
+
+
+/**
+ * 请求队列的 start 回调, 在关中断下把以 rq 开头的一批请求放进一个空闲槽.
+ * 槽 n 固定使用从 n * VBLK_DESC_PER_REQ 开始的描述符, 不需要管理空闲描述符链表
+ */
+static void vblk_start(blk_queue *q, blk_request *rq) {
+    virtio_blk *dev = q->driver_data;
+    uint32_t slot = 0;
+    while (dev->slot_req[slot] != NULL) {
+        slot++;
+    }
+    ASSERT(slot < dev->slots);
+    dev->slot_req[slot] = rq;
+
+    uint16_t head = slot * VBLK_DESC_PER_REQ;
+    vring_desc *desc = &dev->desc[head];
+    vblk_req_hdr *hdr = &dev->hdrs[slot];
+    hdr->type = rq->is_write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    hdr->reserved = 0;
+    hdr->sector = rq->lba;
+    desc[0].addr = addr_v2p((uint32_t)hdr);
+    desc[0].len = sizeof(vblk_req_hdr);
+    desc[0].flags = VRING_DESC_F_NEXT;
+
+    // 每个物理地址段一个描述符, 与上一段相接的段合并. 请求队列的 max_segments 保证描述符够用
+    // 缓冲区在提交时已翻译好, 这里可能位于中断下半部, 当前页表不一定属于提交者
+    uint16_t data_flags = VRING_DESC_F_NEXT | (rq->is_write ? 0 : VRING_DESC_F_WRITE);
+    uint32_t cnt = 1;
+    for (blk_request *req = rq; req != NULL; req = req->next) {
+        for (uint32_t idx = 0; idx < req->nr_segs; idx++) {
+            uint32_t phy = req->segs[idx].phy_addr;
+            if (cnt > 1 && desc[cnt - 1].addr + desc[cnt - 1].len == phy) {
+                desc[cnt - 1].len += req->segs[idx].len;
+            }
+            else {
+                ASSERT(cnt < VBLK_DESC_PER_REQ - 1);
+                desc[cnt].addr = phy;
+                desc[cnt].len = req->segs[idx].len;
+                desc[cnt].flags = data_flags;
+                cnt++;
+            }
+        }
+    }
+
+    dev->status[slot] = 0xff;
+    desc[cnt].addr = addr_v2p((uint32_t)&dev->status[slot]);
+    desc[cnt].len = 1;
+    desc[cnt].flags = VRING_DESC_F_WRITE;
+    for (uint32_t idx = 0; idx < cnt; idx++) {
+        desc[idx].addr_hi = 0;
+        desc[idx].next = head + idx + 1;
+    }
+
+    // 先写好描述符和环中的表项, 再更新 idx, 最后通知设备
+    dev->avail->ring[dev->avail->idx % dev->qsize] = head;
+    barrier();
+    dev->avail->idx++;
+    barrier();
+    outw(dev->iobase + VIRTIO_PCI_QUEUE_NOTIFY, 0);
+}
+
+
+// 上半部: 读 ISR 即清除中断, 第 0 位表示队列有更新. 中断线可能与其它设备共享
+static void intr_virtio_blk_handler(uint8_t vec_nr UNUSED) {
+    bool raise = false;
+    for (uint8_t idx = 0; idx < vblk_cnt; idx++) {
+        if (inb(vblk_devs[idx].iobase + VIRTIO_PCI_ISR) & 1) {
+            vblk_devs[idx].pending = true;
+            raise = true;
+        }
+    }
+    if (raise) {
+        raise_softirq(VIRTIO_SOFTIRQ);
+    }
+}
+
+
+// 下半部: 取出已用环中新完成的描述符链, 由链头下标得到槽号
+static void vblk_do_softirq(void) {
+    for (uint8_t idx = 0; idx < vblk_cnt; idx++) {
+        virtio_blk *dev = &vblk_devs[idx];
+        blk_request *done_req[VBLK_MAX_INFLIGHT];
+        bool done_err[VBLK_MAX_INFLIGHT];
+        uint32_t done_cnt = 0;
+
+        intr_status old_status = intr_disable();
+        if (!dev->pending) {
+            intr_set_status(old_status);
+            continue;
+        }
+        dev->pending = false;
+        while (dev->last_used != dev->used->idx) {
+            barrier();
+            uint32_t head = dev->used->ring[dev->last_used % dev->qsize].id;
+            uint32_t slot = head / VBLK_DESC_PER_REQ;
+            ASSERT(slot < dev->slots && dev->slot_req[slot] != NULL);
+            done_req[done_cnt] = dev->slot_req[slot];
+            done_err[done_cnt] = dev->status[slot] != VIRTIO_BLK_S_OK;
+            done_cnt++;
+            dev->slot_req[slot] = NULL;
+            dev->last_used++;
+        }
+        intr_set_status(old_status);
+
+        for (uint32_t i = 0; i < done_cnt; i++) {
+            if (done_err[i]) {
+                printk("%s: request at lba %d failed\n", dev->hd.name, done_req[i]->lba);
+            }
+            blk_complete(&dev->queue, done_req[i], done_err[i]);
+        }
+    }
+}
+
+
+// 按 legacy 规范的顺序初始化设备, 注册为 disk
+static bool vblk_probe(pci_dev *pdev) {
+    uint32_t bar0 = pci_read(pdev, PCI_BAR(0));
+    if (!(bar0 & 1) || pdev->irq_line >= 16) {
+        printk("    virtio-blk: unsupported bar0 0x%x irq %d\n", bar0, pdev->irq_line);
+        return false;
+    }
+    pci_enable_bus_master(pdev);
+
+    virtio_blk *dev = &vblk_devs[vblk_cnt];
+    dev->iobase = bar0 & 0xfffc;
+    outb(dev->iobase + VIRTIO_PCI_STATUS, 0);   // 复位
+    outb(dev->iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACK);
+    outb(dev->iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+    outl(dev->iobase + VIRTIO_PCI_GUEST_FEATURES, 0);   // 不协商任何可选特性
+    if (!vring_setup(dev)) {
+        printk("    virtio-blk at 0x%x: queue setup failed\n", dev->iobase);
+        outb(dev->iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+        return false;
+    }
+
+    disk *hd = &dev->hd;
+    sprintf(hd->name, "vd%c", 'a' + vblk_cnt);
+    hd->my_channel = NULL;
+    hd->dev_no = 0;
+    hd->dma = true;
+    hd->auto_format = false;    // 可能是宿主机提供的已有镜像, 不自动格式化
+    hd->pio_block = 0;
+    hd->lba48 = true;
+    hd->sectors = inl(dev->iobase + VIRTIO_PCI_CONFIG);
+    if (inl(dev->iobase + VIRTIO_PCI_CONFIG + 4) != 0) {
+        hd->sectors = 0xffffffff;
+    }
+    hd->max_sectors = VBLK_MAX_SECTORS;
+    printk("    disk %s: io 0x%x, irq %d, SECTORS: %d, CAPACITY: %dMB, QUEUE: %d, DEPTH: %d\n",
+           hd->name, dev->iobase, pdev->irq_line, hd->sectors, hd->sectors / 2048, dev->qsize, dev->slots);
+
+    blk_queue_init(&dev->queue, hd->name, VBLK_MAX_SECTORS, VBLK_MAX_SEGS, dev->slots, vblk_start, dev);
+    hd->queue = &dev->queue;
+    outb(dev->iobase + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    request_irq(pdev->irq_line, intr_virtio_blk_handler, "virtio-blk", true);
+    vblk_cnt++;
+    return true;
+}
+
+
+void virtio_blk_init(void) {
+    printk("\nvirtio_blk_init start\n");
+    open_softirq(VIRTIO_SOFTIRQ, vblk_do_softirq);
+    pci_dev *pdev;
+    for (uint32_t nth = 0; vblk_cnt < VBLK_MAX_DEVS &&
+         (pdev = pci_find_device(VIRTIO_VENDOR_ID, VIRTIO_BLK_DEV_ID, nth)) != NULL; nth++) {
+        vblk_probe(pdev);
+    }
+    if (vblk_cnt == 0) {
+        printk("virtio_blk_init done, no disk\n");
+        return;
+    }
+
+    // 打开中断之后才能经由请求队列读分区表
+    for (uint8_t idx = 0; idx < vblk_cnt; idx++) {
+        disk_partition_scan(&vblk_devs[idx].hd);
+    }
+    printk("virtio_blk_init done\n");
+}
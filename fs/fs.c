@@ -935,53 +935,44 @@ int32_t sys_stat(const char *path, stat *buf) {
 }
 
 
-void fs_init() {
-    uint8_t channel_no = 0, dev_no, part_idx = 0;
+/**
+ * 检查分区上是否有本文件系统, 没有则格式化. arg 是读超级块用的缓冲区.
+ * 只格式化驱动标记了 auto_format 的硬盘 (如 ide 硬盘), sata 和 virtio 硬盘上的分区保持原样
+ */
+static bool partition_check_fs(list_elem* pelem, int arg) {
+    super_block* sb_buf = (super_block*)arg;
+    partition* part = elem2entry(partition, part_tag, pelem);
+
+    memset(sb_buf, 0, SECTOR_SIZE);
+    ide_read(part->my_disk, part->start_lba + 1, sb_buf, 1); // 读出分区的超级块
 
+    if (sb_buf->magic == 0x19780506) {
+        printk("%s has filesystem\n", part->name);
+    }
+    else if (!part->my_disk->auto_format) {
+        printk("%s has no filesystem, skipped\n", part->name);
+    }
+    else {  // 其它文件系统不支持,一律按无文件系统处理
+        printk("formatting %s's partition %s......\n", part->my_disk->name, part->name);
+        partition_format(part);
+    }
+    return false;
+}
+
+
+void fs_init() {
     // sb_buf 用来存储从硬盘上读入的超级块
     super_block* sb_buf = (super_block*)sys_malloc(SECTOR_SIZE);
     if (sb_buf == NULL) {
         PANIC("alloc memory failed!");
     }
 
+    // partition_list 中是所有块设备上扫描到的分区, 裸盘 hd60M.img 不在其中
     printk("\nsearching filesystem...\n");
-    while (channel_no < channel_cnt) {
-        dev_no = 0;
-        while(dev_no < 2) {
-            if (dev_no == 0) {  // 跨过裸盘 hd60M.img
-                dev_no++;
-                continue;
-            }
-            disk* hd = &channels[channel_no].devices[dev_no];
-            partition* part = hd->prim_parts;
-            while(part_idx < 12) {      // 4 个主分区和 8 个逻辑
-                if (part_idx == 4) {    // 开始处理逻辑分区
-                    part = hd->logic_parts;
-                }
-
-                if (part->sec_cnt != 0) {   // 如果分区存在
-                    memset(sb_buf, 0, SECTOR_SIZE);
-
-                    ide_read(hd, part->start_lba + 1, sb_buf, 1); // 读出分区的超级块
-
-                    if (sb_buf->magic == 0x19780506) {
-                        printk("%s has filesystem\n", part->name);
-                    }
-                    else {  // 其它文件系统不支持,一律按无文件系统处理
-                        printk("formatting %s's partition %s......\n", hd->name, part->name);
-                        partition_format(part);
-                    }
-                }
-                part_idx++;
-                part++; // 下一分区
-            }
-            dev_no++;   // 下一磁盘
-        }
-        channel_no++;   // 下一通道
-    }
+    list_traversal(&partition_list, partition_check_fs, (int)sb_buf);
     sys_free(sb_buf);
 
-    char default_part[8] = "sdb1";  // 确定默认操作的分区
+    char default_part[8] = ROOT_PART;   // 确定默认操作的分区
     list_traversal(&partition_list, mount_partition, (int)default_part);    // 挂载分区
     open_root_dir(cur_part);
 
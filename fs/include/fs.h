@@ -12,6 +12,11 @@
 
 #define MAX_PATH_LEN 512        // 路径最大长度
 
+// 默认挂载的分区, 可在 defines.mk 中改为内存盘 ram0 等
+#ifndef ROOT_PART
+#define ROOT_PART "sdb1"
+#endif
+
 
 typedef enum file_types {
     FT_UNKNOWN,     // 不支持的文件类型
@@ -0,0 +1,95 @@
+#include "tsc.h"
+#include "global.h"
+#include "thread.h"
+#include "interrupt.h"
+
+#include "cputime.h"
+
+/**
+ * 每次用户态与内核态之间的切换和每次任务切换都用 TSC 打时间戳,
+ * 两个时间戳之间的周期数按所处状态计入 utime 或 stime. 中断处理的时间计入被中断的任务
+ */
+
+
+// 由中断和系统调用入口调用, cs 为被中断代码的段选择子. 从用户态进入时, 此前的时间是用户态时间
+void acct_kernel_enter(uint32_t cs) {
+    if ((cs & 3) != 3) {
+        return;
+    }
+    task_struct *cur = running_thread();
+    uint64_t now = rdtsc64();
+    cur->utime += now - cur->acct_tsc;
+    cur->acct_tsc = now;
+}
+
+
+// 由 intr_exit 调用, 即将返回用户态时, 此前的时间是内核态时间
+void acct_kernel_exit(uint32_t cs) {
+    if ((cs & 3) != 3) {
+        return;
+    }
+    task_struct *cur = running_thread();
+    uint64_t now = rdtsc64();
+    cur->stime += now - cur->acct_tsc;
+    cur->acct_tsc = now;
+}
+
+
+// 由 schedule 在 switch_to 之前调用, 任务切换总是发生在内核态
+void acct_switch(task_struct *prev, task_struct *next) {
+    uint64_t now = rdtsc64();
+    prev->stime += now - prev->acct_tsc;
+    next->acct_tsc = now;
+}
+
+
+// 回收子任务时把它及其已回收后代的 cpu 时间累加到父任务
+void acct_reap(task_struct *parent, task_struct *child) {
+    parent->cutime += child->utime + child->cutime;
+    parent->cstime += child->stime + child->cstime;
+}
+
+
+static void cycles_to_timeval(uint64_t cycles, timeval *tv) {
+    uint32_t usec;
+    tv->tv_sec = (uint32_t)div_u64_rem(cycles_to_us(cycles), 1000000, &usec);
+    tv->tv_usec = usec;
+}
+
+
+/**
+ * who 为 RUSAGE_SELF 时返回调用者自己的 cpu 时间和切换次数,
+ * 为 RUSAGE_CHILDREN 时返回已被回收的子任务的 cpu 时间之和. 成功返回 0
+ */
+int32_t sys_getrusage(int32_t who, rusage *ru) {
+    task_struct *cur = running_thread();
+    uint64_t utime, stime;
+
+    intr_status old_status = intr_disable();
+    if (who == RUSAGE_SELF) {
+        // 把本次系统调用到现在为止的时间也算上
+        uint64_t now = rdtsc64();
+        cur->stime += now - cur->acct_tsc;
+        cur->acct_tsc = now;
+        utime = cur->utime;
+        stime = cur->stime;
+        ru->ru_nvcsw = cur->nvcsw;
+        ru->ru_nivcsw = cur->nivcsw;
+    }
+    else if (who == RUSAGE_CHILDREN) {
+        utime = cur->cutime;
+        stime = cur->cstime;
+        ru->ru_nvcsw = ru->ru_nivcsw = 0;
+    }
+    else {
+        intr_set_status(old_status);
+        return -1;
+    }
+    intr_set_status(old_status);
+
+    ru->ru_ucycles = utime;
+    ru->ru_scycles = stime;
+    cycles_to_timeval(utime, &ru->ru_utime);
+    cycles_to_timeval(stime, &ru->ru_stime);
+    return 0;
+}
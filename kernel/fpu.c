@@ -0,0 +1,280 @@
+#include "list.h"
+#include "print.h"
+#include "debug.h"
+#include "global.h"
+#include "memory.h"
+#include "string.h"
+#include "interrupt.h"
+#include "stdio_kernel.h"
+#include "wait_exit.h"
+
+#include "fpu.h"
+
+#define CR0_MP  (1 << 1)    // 监控协处理器, 配合 TS 使 wait/fwait 也触发 #NM
+#define CR0_EM  (1 << 2)    // 置 1 表示没有 FPU, 所有浮点指令触发 #NM
+#define CR0_TS  (1 << 3)    // 任务切换标志, 置 1 时首条 FPU/SSE 指令触发 #NM
+#define CR0_NE  (1 << 5)    // 浮点错误以 #MF 异常报告
+
+#define CR4_OSFXSR      (1 << 9)    // 操作系统支持 fxsave/fxrstor, 同时启用 SSE 指令
+#define CR4_OSXMMEXCPT  (1 << 10)   // SIMD 浮点异常以 #XF 报告
+
+#define CPUID_EDX_FXSR  (1 << 24)
+#define CPUID_EDX_SSE   (1 << 25)
+
+#define FCW_DEFAULT     0x037f      // fninit 后的 x87 控制字
+#define MXCSR_DEFAULT   0x1f80      // 屏蔽所有 SIMD 浮点异常
+
+#define NM_VEC_NO 0x07
+
+
+/**
+ * 惰性切换: 切换任务时并不保存 FPU 寄存器, 只在下一个任务不是 fpu_owner 时置 CR0.TS.
+ * 任务第一次使用 FPU/SSE 时触发 #NM, 由 fpu_nm_handler 保存 fpu_owner 的状态并恢复自己的.
+ * FXSAVE 区域在任务首次使用 FPU 时才分配, 从不使用 FPU 的任务既不占用 512 字节,
+ * 也不会多执行任何保存和恢复.
+ */
+static bool fpu_enabled;        // cpu 支持 fxsave 和 SSE
+static bool ts_set;             // CR0.TS 的当前值, 避免每次切换都写 CR0
+static task_struct *fpu_owner;  // FPU 寄存器中保存的是哪个任务的状态
+static list fpu_state_pool;     // 空闲的 FXSAVE 区域
+
+
+static inline uint32_t read_cr0(void) {
+    uint32_t cr0;
+    asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+    return cr0;
+}
+
+
+static inline void write_cr0(uint32_t cr0) {
+    asm volatile ("movl %0, %%cr0" : : "r" (cr0) : "memory");
+}
+
+
+static inline void clts(void) {
+    asm volatile ("clts" : : : "memory");
+    ts_set = false;
+}
+
+
+static inline void stts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+    ts_set = true;
+}
+
+
+static inline void fxsave(void *state) {
+    asm volatile ("fxsave (%0)" : : "r" (state) : "memory");
+}
+
+
+static inline void fxrstor(void *state) {
+    asm volatile ("fxrstor (%0)" : : "r" (state) : "memory");
+}
+
+
+// 写入 fninit 和默认 MXCSR 对应的 FXSAVE 映像, 任务首次使用 FPU 时由 fxrstor 载入
+static void fpu_state_reset(void *state) {
+    memset(state, 0, FPU_STATE_SIZE);
+    *(uint16_t *)state = FCW_DEFAULT;
+    *(uint32_t *)((uint8_t *)state + 24) = MXCSR_DEFAULT;
+}
+
+
+/**
+ * 分配并初始化一个 FXSAVE 区域, 需在开中断下调用, 不支持 FPU 或内存不足时返回 NULL.
+ * 区域从内核页中按 512 字节切分, 页框天然满足 16 字节对齐, 释放后留在池中复用.
+ * 检查和取出在同一关中断区间内完成; 池空时开中断补充一页, 补充后重新检查,
+ * 因为期间其它任务可能已经取走了新补充的区域
+ */
+static void *fpu_state_alloc(void) {
+    if (!fpu_enabled) {
+        return NULL;
+    }
+    while (1) {
+        intr_status old_status = intr_disable();
+        if (!list_empty(&fpu_state_pool)) {
+            void *state = (void *)list_pop(&fpu_state_pool);
+            intr_set_status(old_status);
+            fpu_state_reset(state);
+            return state;
+        }
+        intr_set_status(old_status);
+
+        uint8_t *page = get_kernel_pages(1);
+        if (page == NULL) {
+            return NULL;
+        }
+        old_status = intr_disable();
+        for (uint32_t off = 0; off < PG_SIZE; off += FPU_STATE_SIZE) {
+            list_append(&fpu_state_pool, (list_elem *)(page + off));
+        }
+        intr_set_status(old_status);
+    }
+}
+
+
+static void fpu_state_free(void *state) {
+    list_append(&fpu_state_pool, (list_elem *)state);
+}
+
+
+// 将 FPU 中 fpu_owner 的状态写回其 FXSAVE 区域
+static void fpu_save_owner(void) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    if (fpu_owner != NULL) {
+        clts();
+        fxsave(fpu_owner->fpu_state);
+        fpu_owner = NULL;
+    }
+}
+
+
+// #NM 异常: 当前任务首次在本次调度中使用 FPU/SSE
+static void fpu_nm_handler(void) {
+    if (!fpu_enabled) {
+        PANIC("fpu_nm_handler: FPU/SSE not supported\n");
+    }
+    task_struct *cur = running_thread();
+    ASSERT(fpu_owner != cur);
+
+    /**
+     * 首次使用时分配 FXSAVE 区域. 内核代码只在 kernel_fpu_begin 之后使用 SSE, 那时 TS 已清除,
+     * 所以这里总是用户进程在开中断的用户态触发的, 可以开中断去分配内存
+     */
+    if (cur->fpu_state == NULL) {
+        if (cur->pgdir == NULL) {
+            PANIC("fpu_nm_handler: kernel thread used FPU outside kernel_fpu_begin\n");
+        }
+        intr_enable();
+        void *state = fpu_state_alloc();
+        if (state == NULL) {
+            printk("fpu_nm_handler: no memory for FPU state, killing %s\n", cur->name);
+            sys_exit(-1);
+        }
+        intr_disable();
+        cur->fpu_state = state;
+    }
+
+    fpu_save_owner();
+    clts();
+    fxrstor(cur->fpu_state);
+    fpu_owner = cur;
+}
+
+
+// 在 switch_to 之前调用, 只有 next 不持有 FPU 时才需要置 TS
+void fpu_switch_to(task_struct *next) {
+    if (!fpu_enabled) {
+        return;
+    }
+    bool need_ts = (next != fpu_owner);
+    if (need_ts && !ts_set) {
+        stts();
+    }
+    else if (!need_ts && ts_set) {
+        clts();
+    }
+}
+
+
+// fork 时为子进程分配 FXSAVE 区域并复制父进程的 FPU 状态, 父进程从未使用过 FPU 时子进程同样不分配
+int32_t fpu_copy(task_struct *child, task_struct *parent) {
+    child->fpu_state = NULL;
+    if (parent->fpu_state == NULL) {
+        return 0;
+    }
+
+    child->fpu_state = fpu_state_alloc();
+    if (child->fpu_state == NULL) {
+        return -1;
+    }
+
+    intr_status old_status = intr_disable();
+    if (fpu_owner == parent) {
+        fpu_save_owner();
+        stts();
+    }
+    intr_set_status(old_status);
+
+    memcpy(child->fpu_state, parent->fpu_state, FPU_STATE_SIZE);
+    return 0;
+}
+
+
+// exec 时丢弃当前任务的 FPU 状态, 新程序从干净的状态开始
+void fpu_reset(task_struct *pthread) {
+    intr_status old_status = intr_disable();
+    if (fpu_owner == pthread) {
+        fpu_owner = NULL;
+        stts();     // 之后的 FPU 指令重新触发 #NM 以载入干净的状态
+    }
+    if (pthread->fpu_state != NULL) {
+        fpu_state_reset(pthread->fpu_state);
+    }
+    intr_set_status(old_status);
+}
+
+
+// 任务退出时释放其 FXSAVE 区域
+void fpu_release(task_struct *pthread) {
+    intr_status old_status = intr_disable();
+    if (fpu_owner == pthread) {
+        fpu_owner = NULL;
+        if (pthread == running_thread()) {
+            stts();
+        }
+    }
+    if (pthread->fpu_state != NULL) {
+        fpu_state_free(pthread->fpu_state);
+        pthread->fpu_state = NULL;
+    }
+    intr_set_status(old_status);
+}
+
+
+/**
+ * 内核代码使用 SSE 前调用, 期间保持关中断, 不能阻塞, 也不能嵌套.
+ * 先把 fpu_owner 的状态保存起来, 内核使用完毕后由 #NM 惰性恢复
+ */
+static intr_status kernel_fpu_old_status;
+
+void kernel_fpu_begin(void) {
+    ASSERT(fpu_enabled);
+    kernel_fpu_old_status = intr_disable();
+    fpu_save_owner();
+    clts();
+}
+
+
+void kernel_fpu_end(void) {
+    stts();
+    intr_set_status(kernel_fpu_old_status);
+}
+
+
+void fpu_init(void) {
+    put_str("\nfpu_init start\n");
+    uint32_t eax = 1, ebx, ecx, edx;
+    asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+
+    list_init(&fpu_state_pool);
+    register_handler(NM_VEC_NO, fpu_nm_handler);
+
+    uint32_t cr0 = read_cr0();
+    if ((edx & CPUID_EDX_FXSR) && (edx & CPUID_EDX_SSE)) {
+        write_cr0((cr0 & ~CR0_EM) | CR0_MP | CR0_NE | CR0_TS);
+        uint32_t cr4;
+        asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+        cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+        asm volatile ("movl %0, %%cr4" : : "r" (cr4));
+        fpu_enabled = true;
+        ts_set = true;
+        put_str("    FPU/SSE enabled, lazy context switch\n");
+    }
+    else {
+        write_cr0(cr0 | CR0_EM);    // 任何浮点指令都会触发 #NM 并报错
+        put_str("    FPU/SSE not supported\n");
+    }
+    put_str("fpu_init done\n");
+}
@@ -0,0 +1,16 @@
+#ifndef __KERNEL_CPUTIME_H__
+#define __KERNEL_CPUTIME_H__
+
+#include "stdint.h"
+#include "thread.h"
+#include "syscall.h"
+
+
+void acct_kernel_enter(uint32_t cs);
+void acct_kernel_exit(uint32_t cs);
+void acct_switch(task_struct *prev, task_struct *next);
+void acct_reap(task_struct *parent, task_struct *child);
+
+int32_t sys_getrusage(int32_t who, rusage *ru);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef __KERNEL_FPU_H__
+#define __KERNEL_FPU_H__
+
+#include "stdint.h"
+#include "thread.h"
+
+#define FPU_STATE_SIZE 512  // FXSAVE 区域大小, 须 16 字节对齐
+
+
+void fpu_init(void);
+void fpu_switch_to(task_struct *next);
+int32_t fpu_copy(task_struct *child, task_struct *parent);
+void fpu_reset(task_struct *pthread);
+void fpu_release(task_struct *pthread);
+
+void kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+
+#endif
@@ -2,11 +2,14 @@
 #define __KERNEL_INTERRUPT_H__
 
 #include "stdint.h"
+#include "global.h"
 
 typedef void* intr_handler;
 
 void idt_init(void);
+void apic_init(void);
 void register_handler(uint8_t vector_no, intr_handler function);
+void request_irq(uint8_t irq, intr_handler function, const char *name, bool level);
 
 
 /* 定义中断的两种状态:
@@ -23,4 +26,8 @@ intr_status intr_set_status (intr_status);
 intr_status intr_enable (void);
 intr_status intr_disable (void);
 
+void intr_trace_entry(uint8_t vec_nr, uint32_t eflags);
+void intr_trace_exit(uint32_t eflags);
+void intr_trace_print(void);
+
 #endif
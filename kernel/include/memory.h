@@ -11,6 +11,8 @@
 #define PG_RW_W 2   // R/W 属性位值, 读/写/执行
 #define PG_US_S 0   // U/S 属性位值, 系统级
 #define PG_US_U 4   // U/S 属性位值, 用户级
+#define PG_PWT  8   // 页写穿透
+#define PG_PCD  16  // 页禁用缓存, 用于映射设备寄存器
 
 #define DESC_CNT 7  // 内存描述符个数
 
@@ -45,6 +47,8 @@ void *sys_malloc(uint32_t size);
 void mfree_page(pool_flags pf, void *_vaddr, uint32_t pg_cnt);
 void pfree(uint32_t pg_phy_addr);
 void sys_free(void *ptr);
+void *kmalloc(uint32_t size);
+void kfree(void *ptr);
 
 void block_desc_init(mem_block_desc *desc_array);
 
@@ -61,5 +65,8 @@ void *malloc_page(pool_flags pf, uint32_t pg_cnt);
 uint32_t *pte_vaddr(uint32_t vaddr);
 uint32_t *pde_vaddr(uint32_t vaddr);
 
+void *ioremap(uint32_t phy_addr, uint32_t size);
+void *kmap_atomic(uint32_t phy_addr);
+
 
 #endif
@@ -0,0 +1,34 @@
+#ifndef __KERNEL_MP_H__
+#define __KERNEL_MP_H__
+
+#include "stdint.h"
+#include "global.h"
+
+#define MAX_CPUS        8
+#define ISA_IRQ_CNT     16
+
+#define MP_IRQ_POL_LOW      (1 << 0)    // 低电平有效
+#define MP_IRQ_TRIG_LEVEL   (1 << 1)    // 电平触发
+
+
+// 从 MP 配置表中解析出的处理器及中断路由信息
+typedef struct mp_info {
+    bool found;                     // 是否找到了有效的 MP 配置表
+    uint8_t cpu_cnt;                // 可用处理器个数, 其余处理器不会被启动, 只有 BSP 运行内核
+    uint8_t bsp_idx;                // BSP 在 apic_id 中的下标
+    uint8_t apic_id[MAX_CPUS];      // 各处理器的 local APIC ID
+    uint32_t lapic_addr;            // local APIC 的物理地址
+    bool has_ioapic;
+    uint8_t ioapic_id;
+    uint32_t ioapic_addr;           // (第一个) IOAPIC 的物理地址
+    bool imcr;                      // 存在 IMCR, 切换到 APIC 模式前要先写 IMCR
+    uint8_t irq_pin[ISA_IRQ_CNT];   // ISA IRQ 接在 IOAPIC 的哪个引脚上
+    uint8_t irq_flags[ISA_IRQ_CNT]; // MP_IRQ_POL_LOW, MP_IRQ_TRIG_LEVEL
+} mp_info;
+
+
+extern mp_info mp;
+
+void mp_init(void);
+
+#endif
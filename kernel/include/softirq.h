@@ -0,0 +1,29 @@
+#ifndef __KERNEL_SOFTIRQ_H__
+#define __KERNEL_SOFTIRQ_H__
+
+#include "stdint.h"
+#include "thread.h"
+
+
+// 软中断号, 编号越小越先执行
+typedef enum softirq_nr {
+    TIMER_SOFTIRQ,  // 到期的内核定时器
+    KBD_SOFTIRQ,    // 键盘扫描码解码
+    HD_SOFTIRQ,     // 硬盘中断的下半部
+    AHCI_SOFTIRQ,   // sata 硬盘中断的下半部
+    VIRTIO_SOFTIRQ, // virtio 块设备中断的下半部
+    NR_SOFTIRQS
+} softirq_nr;
+
+
+typedef void softirq_action(void);
+
+void open_softirq(softirq_nr nr, softirq_action action);
+void raise_softirq(softirq_nr nr);
+void do_softirq(void);
+void softirq_switch_out(task_struct *cur);
+void irq_exit(uint8_t vec_nr, uint32_t enter_tsc);
+
+void softirq_stat_print(void);
+
+#endif
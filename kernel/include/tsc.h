@@ -0,0 +1,46 @@
+#ifndef __KERNEL_TSC_H__
+#define __KERNEL_TSC_H__
+
+#include "stdint.h"
+
+
+extern uint32_t tsc_khz;    // 每毫秒的 tsc 周期数, 由 tsc_init 校准, 校准前为 0
+
+
+// 读取时间戳计数器 TSC, 只取低 32 位, 用于测量较短的时间间隔 (无符号相减可正确处理回绕)
+static inline uint32_t rdtsc32(void) {
+    uint32_t low, high;
+    asm volatile ("rdtsc" : "=a" (low), "=d" (high));
+    return low;
+}
+
+
+// 读取完整的 64 位 TSC, 用于累计 cpu 时间
+static inline uint64_t rdtsc64(void) {
+    uint32_t low, high;
+    asm volatile ("rdtsc" : "=a" (low), "=d" (high));
+    return ((uint64_t)high << 32) | low;
+}
+
+
+/**
+ * 64 位除以 32 位, 返回商, 余数存入 rem (可为 NULL).
+ * 没有 libgcc, 不能直接对 uint64_t 做除法, 故分两次用 divl 完成
+ */
+static inline uint64_t div_u64_rem(uint64_t n, uint32_t d, uint32_t *rem) {
+    uint32_t high = (uint32_t)(n >> 32);
+    uint32_t q_high = high / d;
+    uint32_t q_low, r = high % d;
+    asm ("divl %4" : "=a" (q_low), "=d" (r) : "a" ((uint32_t)n), "d" (r), "rm" (d));
+    if (rem) {
+        *rem = r;
+    }
+    return ((uint64_t)q_high << 32) | q_low;
+}
+
+
+void tsc_init(void);
+uint64_t cycles_to_us(uint64_t cycles);
+uint32_t cycles_to_ms(uint64_t cycles);
+
+#endif
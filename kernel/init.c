@@ -1,12 +1,24 @@
+#include "mp.h"
 #include "fs.h"
+#include "fpu.h"
+#include "tsc.h"
+#include "futex.h"
 #include "tss.h"
 #include "ide.h"
+#include "ahci.h"
+#include "virtio_blk.h"
+#include "raid.h"
+#include "ramdisk.h"
+#include "blk.h"
+#include "sync.h"
+#include "pci.h"
 #include "print.h"
 #include "timer.h"
 #include "memory.h"
 #include "thread.h"
 #include "console.h"
 #include "keyboard.h"
+#include "workqueue.h"
 #include "interrupt.h"
 #include "syscall_init.h"
 
@@ -15,9 +27,14 @@
 
 void init_all() {
     idt_init();     // 初始化中断
+    lock_stat_init();   // 初始化锁竞争统计链表, 之后各子系统才能登记锁
     mem_init();     // 初始化内存管理系统
+    fpu_init();     // 启用 SSE 及 FPU 惰性切换
+    mp_init();      // 解析 MP 配置表, 获取处理器和 IOAPIC 信息
     thread_init();  // 初始化线程相关结构
+    futex_init();   // 初始化 futex 等待队列
     timer_init();   // 初始化 PIT
+    workqueue_init();   // 创建默认工作队列的 worker 线程
 
     console_init();
     keyboard_init();
@@ -26,7 +43,15 @@ void init_all() {
     syscall_init();
 
     intr_enable();  // 后面的 ide_init 需要打开中断
+    apic_init();    // 有 APIC 时切换到 IOAPIC 和 local APIC 定时器
+    tsc_init();     // 以时钟中断为基准校准 tsc 频率
+    bio_init();     // 初始化请求队列链表和异步块设备读写的 bio 池
+    pci_init();     // 枚举 pci 设备, ide 需要从中找总线主控
     ide_init();     // 初始化硬盘
+    ahci_init();    // 初始化 sata 硬盘
+    virtio_blk_init();  // 初始化 virtio 块设备
+    raid_init();    // 把成员分区组装成 raid 虚拟硬盘
+    ramdisk_init(RAMDISK_SECTORS);  // 创建内存盘
     fs_init();      // 初始化文件系统
 
     put_str("\ninit_all\n\n");
@@ -1,7 +1,15 @@
 #include "io.h"
+#include "tsc.h"
+#include "mp.h"
+#include "lapic.h"
+#include "debug.h"
 #include "print.h"
+#include "ioapic.h"
 #include "stdint.h"
 #include "global.h"
+#include "string.h"
+#include "thread.h"
+#include "stdio_kernel.h"
 #include "interrupt.h"
 
 
@@ -10,12 +18,43 @@
 #define PIC_S_CTRL 0xa0     // 从片的控制端口是 0xa0
 #define PIC_S_DATA 0xa1     // 从片的数据端口是 0xa1
 
+#define IMCR_ADDR 0x22      // IMCR 选择端口, 写入 0x70 后经 0x23 访问 IMCR
+#define IMCR_DATA 0x23
+
+#define TIMER_VEC_NO 0x20
+#define IRQ_VEC_BASE 0x20   // APIC 模式下沿用 8259A 的向量号, 中断处理程序无需改动
+
 #define IDT_DESC_CNT 0x81   // 目前总共支持的中断数
 
 #define EFLAGS_IF 0x00000200    // eflags 寄存器中的 IF 位
 #define GET_EFLAGS(EFLAGS_VAR) asm volatile("pushfl; popl %0" : "=g" (EFLAGS_VAR))
 
 
+#define IRQOFF_WORST_CNT    8   // 记录最长的关中断窗口数
+#define IRQOFF_LOG_CNT      32  // 环形缓冲区大小
+#define IRQOFF_LOG_US       100 // 超过此时长 (微秒) 的窗口记入环形缓冲区
+#define IRQOFF_PRINT_RECENT 8   // 打印环形缓冲区中最近的窗口数
+
+
+// 当前关中断窗口的起点
+typedef struct irqoff_window {
+    uint32_t off_tsc;
+    void *off_site;
+    uint8_t off_vec;
+    bool tracing;
+} irqoff_window;
+
+
+// 一段关中断窗口, 调用点为 NULL 表示由中断入口关闭或由 iret 打开
+typedef struct irqoff_rec {
+    uint32_t cycles;
+    void *off_site;
+    void *on_site;
+    uint8_t vec_nr;     // off_site 为 NULL 时的中断向量号
+    pid_t pid;          // 开中断时的任务
+} irqoff_rec;
+
+
 // 中断门描述符结构体
 typedef struct gate_desc {
     uint16_t func_offset_low_word;
@@ -28,6 +67,11 @@ typedef struct gate_desc {
 
 
 static void make_idt_desc(gate_desc* p_gdesc, uint8_t attr, intr_handler function);
+
+static irqoff_window irqoff_cur;
+static irqoff_rec irqoff_worst[IRQOFF_WORST_CNT];  // 按时长降序
+static irqoff_rec irqoff_log[IRQOFF_LOG_CNT];
+static uint32_t irqoff_log_cnt;     // 写入环形缓冲区的总次数
 static gate_desc idt[IDT_DESC_CNT];              // idt 是中断描述符表, 本质上就是个中断门描述符数组
 
 char* intr_name[IDT_DESC_CNT];          // 用于保存异常的名字
@@ -35,9 +79,16 @@ intr_handler idt_table[IDT_DESC_CNT];   // 定义中断处理程序数组.
                                         // 在 kernel.S 中定义的 intr_XX_entry 只是中断处理程序的入口,
                                         // 最终调用的是 ide_table 中的处理程序
 
+#define IRQ_SHARED_MAX 4    // 一条中断线上最多共享的处理程序数
+static intr_handler irq_actions[ISA_IRQ_CNT][IRQ_SHARED_MAX];   // 由 request_irq 注册的处理程序
+static uint32_t irq_action_cnt[ISA_IRQ_CNT];
+
 extern intr_handler intr_entry_table[IDT_DESC_CNT]; // 声明引用定义在 kernel.S 中的中断处理函数入口数组
 extern uint32_t syscall_handler(void);
 
+static void pic_eoi(uint8_t vec_nr);
+void (*intr_eoi)(uint8_t vec_nr) = pic_eoi; // kernel.S 在调用处理程序前通过它发送 EOI
+
 
 // 初始化可编程中断控制器 8259A
 static void pic_init(void) {
@@ -63,6 +114,65 @@ static void pic_init(void) {
 }
 
 
+// 只有来自 8259A 的中断需要 EOI, 从片的中断还要通知主片
+static void pic_eoi(uint8_t vec_nr) {
+    if (vec_nr < 0x20 || vec_nr >= 0x30) {
+        return;
+    }
+    if (vec_nr >= 0x28) {
+        outb(PIC_S_CTRL, 0x20);
+    }
+    outb(PIC_M_CTRL, 0x20);
+}
+
+
+// local APIC 的 EOI 只是一次 MMIO 写, 伪中断不需要 EOI
+static void apic_eoi(uint8_t vec_nr) {
+    if (vec_nr < 0x20 || vec_nr == LAPIC_SPURIOUS_VEC) {
+        return;
+    }
+    lapic_eoi();
+}
+
+
+/**
+ * 若存在 local APIC 和 IOAPIC, 则把外部中断改由 IOAPIC 投递给 BSP,
+ * 时钟中断改用 BSP 的 local APIC 定时器, 并屏蔽 8259A. 否则继续使用 8259A.
+ * 须在开中断后调用, 校准 APIC 定时器需要 PIT 的时钟中断
+ */
+void apic_init(void) {
+    put_str("\napic_init start\n");
+    lapic_init();
+    if (!lapic_available() || !mp.has_ioapic) {
+        put_str("apic_init done, using 8259A\n");
+        return;
+    }
+    ioapic_init();
+    lapic_timer_calibrate();
+
+    intr_status old_status = intr_disable();
+
+    // 屏蔽 8259A 的所有引脚. 有 IMCR 的主板还要把 INTR/NMI 从 8259A 切换到 APIC
+    outb(PIC_M_DATA, 0xff);
+    outb(PIC_S_DATA, 0xff);
+    if (mp.imcr) {
+        outb(IMCR_ADDR, 0x70);
+        outb(IMCR_DATA, 0x01);
+    }
+
+    // 与 pic_init 中打开的中断保持一致: IRQ1 键盘, IRQ14 硬盘
+    uint8_t bsp = lapic_id();
+    ioapic_route(1, IRQ_VEC_BASE + 1, bsp);
+    ioapic_route(14, IRQ_VEC_BASE + 14, bsp);
+
+    intr_eoi = apic_eoi;
+    lapic_timer_start(TIMER_VEC_NO);    // 周期与 PIT 相同, ticks 仍为 100Hz
+
+    intr_set_status(old_status);
+    put_str("apic_init done, using IOAPIC\n");
+}
+
+
 // 创建中断门描述符
 static void make_idt_desc(gate_desc *p_gdesc, uint8_t attr, intr_handler function) {
     p_gdesc->func_offset_low_word = (uint32_t)function & 0x0000FFFF;
@@ -88,6 +198,9 @@ static void general_intr_handler(uint8_t vec_nr) {
     if (vec_nr == 0x27 || vec_nr == 0x2f) { // 0x2f 是从片 8259A 上的最后一个 irq 引脚, 保留项
         return;                             // IRQ7 和 IRQ15 会产生伪中断 (spurious interrupt), 无须处理
     }
+    if (vec_nr == LAPIC_SPURIOUS_VEC) {
+        return;
+    }
     set_cursor(0);
     int cursor_pos = 0;
     while(cursor_pos < 320) {
@@ -103,6 +216,8 @@ static void general_intr_handler(uint8_t vec_nr) {
         asm ("movl %%cr2, %0" : "=r" (page_fault_vaddr));   // cr2 是存放造成 page_fault 的地址
         put_str("\npage fault addr is 0x");
         put_int(page_fault_vaddr);
+        put_str(", task ");
+        put_str(running_thread()->name);
     }
     put_str("\n!!!!!!!      excetion message end    !!!!!!!!\n");
 
@@ -138,13 +253,139 @@ static void exception_init(void) {
     intr_name[17] = "#AC Alignment Check Exception";
     intr_name[18] = "#MC Machine-Check Exception";
     intr_name[19] = "#XF SIMD Floating-Point Exception";
+    intr_name[0x20] = "timer";
+    intr_name[0x21] = "keyboard";
+    intr_name[0x2e] = "ide0";
+    intr_name[0x2f] = "ide1";
+    intr_name[LAPIC_SPURIOUS_VEC] = "lapic spurious";
 
     put_str("    exception_init done\n");
 }
 
 
-// 开中断并返回开中断前的状态
-intr_status intr_enable() {
+// 刚关中断, site 为关中断的调用点, 由中断或系统调用入口关闭时为 NULL
+static void irqoff_begin(void *site, uint8_t vec_nr) {
+    irqoff_window *c = &irqoff_cur;
+    c->off_tsc = rdtsc32();
+    c->off_site = site;
+    c->off_vec = vec_nr;
+    c->tracing = true;
+}
+
+
+static inline bool irqoff_same_site(irqoff_rec *a, irqoff_rec *b) {
+    return a->off_site == b->off_site && a->on_site == b->on_site &&
+           (a->off_site != NULL || a->vec_nr == b->vec_nr);
+}
+
+
+// 把 rec 按时长插入最坏窗口表, 同一对调用点只保留最长的一次
+static void irqoff_worst_insert(irqoff_rec *rec) {
+    int32_t idx = IRQOFF_WORST_CNT - 1;
+    for (int32_t i = 0; i < IRQOFF_WORST_CNT; i++) {
+        if (irqoff_worst[i].cycles != 0 && irqoff_same_site(&irqoff_worst[i], rec)) {
+            if (irqoff_worst[i].cycles >= rec->cycles) {
+                return;
+            }
+            idx = i;
+            break;
+        }
+    }
+    if (irqoff_worst[idx].cycles >= rec->cycles) {
+        return;
+    }
+    while (idx > 0 && irqoff_worst[idx - 1].cycles < rec->cycles) {
+        irqoff_worst[idx] = irqoff_worst[idx - 1];
+        idx--;
+    }
+    irqoff_worst[idx] = *rec;
+}
+
+
+// 即将开中断, site 为开中断的调用点, 由 iret 恢复时为 NULL
+static void irqoff_end(void *site) {
+    irqoff_window *c = &irqoff_cur;
+    if (!c->tracing) {
+        return;
+    }
+    c->tracing = false;
+
+    irqoff_rec rec;
+    rec.cycles = rdtsc32() - c->off_tsc;
+    rec.off_site = c->off_site;
+    rec.on_site = site;
+    rec.vec_nr = c->off_vec;
+    rec.pid = running_thread()->pid;
+
+    irqoff_worst_insert(&rec);
+    if (tsc_khz != 0 && rec.cycles / IRQOFF_LOG_US >= tsc_khz / 1000) {
+        irqoff_log[irqoff_log_cnt++ % IRQOFF_LOG_CNT] = rec;
+    }
+}
+
+
+// 由中断和系统调用入口调用, 被中断的代码开着中断时, 从这里开始一段关中断窗口
+void intr_trace_entry(uint8_t vec_nr, uint32_t eflags) {
+    if (eflags & EFLAGS_IF) {
+        irqoff_begin(NULL, vec_nr);
+    }
+}
+
+
+// 由 intr_exit 调用, iret 将恢复开中断时结束关中断窗口
+void intr_trace_exit(uint32_t eflags) {
+    if (eflags & EFLAGS_IF) {
+        irqoff_end(NULL);
+    }
+}
+
+
+static void irqoff_print_rec(irqoff_rec *rec) {
+    uint32_t tsc_mhz = tsc_khz / 1000;
+    printk("    %d  %d  ", rec->cycles, tsc_mhz == 0 ? 0 : rec->cycles / tsc_mhz);
+    if (rec->off_site == NULL) {
+        printk("int 0x%x  ", rec->vec_nr);
+    }
+    else {
+        printk("0x%x  ", rec->off_site);
+    }
+    if (rec->on_site == NULL) {
+        printk("iret  ");
+    }
+    else {
+        printk("0x%x  ", rec->on_site);
+    }
+    printk("%d\n", rec->pid);
+}
+
+
+// 打印最长的关中断窗口及最近超过 IRQOFF_LOG_US 的窗口, 调用点可在 kernel.map 中查找
+void intr_trace_print(void) {
+    irqoff_rec worst[IRQOFF_WORST_CNT];
+    irqoff_rec recent[IRQOFF_PRINT_RECENT];
+    uint32_t recent_cnt = 0;
+
+    // 先复制一份, 打印期间可能记录新的窗口
+    intr_status old_status = intr_disable();
+    memcpy(worst, irqoff_worst, sizeof(worst));
+    for (uint32_t i = 0; i < IRQOFF_PRINT_RECENT && i < irqoff_log_cnt && i < IRQOFF_LOG_CNT; i++) {
+        recent[recent_cnt++] = irqoff_log[(irqoff_log_cnt - 1 - i) % IRQOFF_LOG_CNT];
+    }
+    intr_set_status(old_status);
+
+    printk("interrupts-off windows, worst:\n");
+    printk("    CYCLES  US  OFF  ON  PID\n");
+    for (uint32_t i = 0; i < IRQOFF_WORST_CNT && worst[i].cycles != 0; i++) {
+        irqoff_print_rec(&worst[i]);
+    }
+    printk("recent (>= %dus):\n", IRQOFF_LOG_US);
+    for (uint32_t i = 0; i < recent_cnt; i++) {
+        irqoff_print_rec(&recent[i]);
+    }
+}
+
+
+static intr_status do_intr_enable(void *site) {
     intr_status old_status;
     if (intr_get_status() == INTR_ON) {
         old_status = INTR_ON;
@@ -152,18 +393,19 @@ intr_status intr_enable() {
     }
     else {
         old_status = INTR_OFF;
+        irqoff_end(site);
         asm volatile("sti");    // 开中断, sti 指令将 IF 位置 1
         return old_status;
     }
 }
 
 
-// 关中断, 并且返回关中断前的状态
-intr_status intr_disable() {     
+static intr_status do_intr_disable(void *site) {
     intr_status old_status;
     if (INTR_ON == intr_get_status()) {
         old_status = INTR_ON;
         asm volatile("cli" : : : "memory"); // 关中断, cli 指令将 IF 位置 0
+        irqoff_begin(site, 0);
         return old_status;
     }
     else {
@@ -173,9 +415,22 @@ intr_status intr_disable() {
 }
 
 
-// 将中断状态设置为 status
+// 开中断并返回开中断前的状态
+intr_status intr_enable() {
+    return do_intr_enable(__builtin_return_address(0));
+}
+
+
+// 关中断, 并且返回关中断前的状态
+intr_status intr_disable() {
+    return do_intr_disable(__builtin_return_address(0));
+}
+
+
+// 将中断状态设置为 status, 以调用者作为开关中断的调用点
 intr_status intr_set_status(intr_status status) {
-    return status & INTR_ON ? intr_enable() : intr_disable();
+    void *site = __builtin_return_address(0);
+    return status & INTR_ON ? do_intr_enable(site) : do_intr_disable(site);
 }
 
 
@@ -184,6 +439,46 @@ void register_handler(uint8_t vector_no, intr_handler function) {
 }
 
 
+// 依次调用共享同一中断线的所有处理程序, 各处理程序自己判断中断是否来自本设备
+static void irq_shared_handler(uint8_t vec_nr) {
+    uint8_t irq = vec_nr - IRQ_VEC_BASE;
+    for (uint32_t idx = 0; idx < irq_action_cnt[irq]; idx++) {
+        ((void (*)(uint8_t))irq_actions[irq][idx])(vec_nr);
+    }
+}
+
+
+/**
+ * 为外部中断线 irq 注册处理程序并打开它, 用于 pci 设备这类运行时才知道中断线的设备.
+ * 多个 pci 设备可能共用一条中断线, 所以经由 irq_shared_handler 分发.
+ * pci 的中断线是电平触发的, 8259A 的触发方式已由 BIOS 在 ELCR 中设好, IOAPIC 需要在此设置
+ */
+void request_irq(uint8_t irq, intr_handler function, const char *name, bool level) {
+    ASSERT(irq < ISA_IRQ_CNT && irq_action_cnt[irq] < IRQ_SHARED_MAX);
+    irq_actions[irq][irq_action_cnt[irq]++] = function;
+    register_handler(IRQ_VEC_BASE + irq, irq_shared_handler);
+    if (irq_action_cnt[irq] == 1) {
+        intr_name[IRQ_VEC_BASE + irq] = (char *)name;
+    }
+
+    intr_status old_status = intr_disable();
+    if (intr_eoi == apic_eoi) {
+        if (level) {
+            mp.irq_flags[irq] |= MP_IRQ_TRIG_LEVEL;
+        }
+        ioapic_route(irq, IRQ_VEC_BASE + irq, lapic_id());
+    }
+    else if (irq < 8) {
+        outb(PIC_M_DATA, inb(PIC_M_DATA) & ~(1 << irq));
+    }
+    else {
+        outb(PIC_S_DATA, inb(PIC_S_DATA) & ~(1 << (irq - 8)));
+        outb(PIC_M_DATA, inb(PIC_M_DATA) & ~(1 << 2));  // 从片经主片的 IRQ2 级联
+    }
+    intr_set_status(old_status);
+}
+
+
 // 获取当前中断状态
 intr_status intr_get_status() {
     uint32_t eflags = 0;
@@ -33,7 +33,10 @@ int main(void) {
 
     process_execute(init, "init");
 
-    while(1);
+    // main 线程已无事可做, 阻塞自己, 避免以优先级 31 空转饿死低优先级任务
+    while(1) {
+        thread_block(TASK_BLOCKED);
+    }
 
     return 0;
 }
@@ -45,6 +45,7 @@ typedef struct arena {
 pool kernel_pool, user_pool;    // 生成内核内存池和用户内存池
 virtual_addr kernel_vaddr;      // 此结构是用来给内核分配虚拟地址
 mem_block_desc k_block_descs[DESC_CNT]; // 内核内存块描述符数组
+static uint32_t kmap_vaddr;     // kmap_atomic 使用的一页内核虚拟地址, 不固定对应物理页
 
 
 static void *vaddr_get(pool_flags pf, uint32_t pg_cnt) {
@@ -140,6 +141,43 @@ static void page_table_map(void *_vaddr, void *_page_phyaddr) {
 }
 
 
+/**
+ * 把设备寄存器所在的物理地址按原地址映射到内核空间并禁用缓存.
+ * APIC 等设备位于 0xfec00000 以上, 该区域不在内核堆的虚拟地址池内,
+ * 其页目录项在 loader 中已经创建, 所有进程共享
+ */
+void *ioremap(uint32_t phy_addr, uint32_t size) {
+    ASSERT(phy_addr >= 0xc0000000 && size > 0);
+    uint32_t start = phy_addr & 0xfffff000;
+    uint32_t end = phy_addr + size;
+    intr_status old_status = intr_disable();
+    for (uint32_t addr = start; addr < end; addr += PG_SIZE) {
+        uint32_t *pte = pte_vaddr(addr);
+        ASSERT(*pde_vaddr(addr) & PG_P_1);
+        if (!(*pte & PG_P_1)) {
+            *pte = addr | PG_PCD | PG_PWT | PG_RW_W | PG_US_S | PG_P_1;
+            asm volatile ("invlpg %0" : : "m" (*(char *)addr) : "memory");
+        }
+    }
+    intr_set_status(old_status);
+    return (void *)phy_addr;
+}
+
+
+/**
+ * 把物理地址 phy_addr 所在的页临时映射到内核地址空间, 返回其虚拟地址.
+ * 用于在任意任务的上下文中访问其它进程的页. 只有一个映射槽,
+ * 须关中断调用, 并在再次调用之前用完返回的地址
+ */
+void *kmap_atomic(uint32_t phy_addr) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    uint32_t *pte = pte_vaddr(kmap_vaddr);
+    *pte = (phy_addr & 0xfffff000) | PG_RW_W | PG_US_S | PG_P_1;
+    asm volatile ("invlpg %0" : : "m" (*(char *)kmap_vaddr) : "memory");
+    return (void *)(kmap_vaddr + (phy_addr & 0x00000fff));
+}
+
+
 // 分配 pg_cnt 个页空间
 void *malloc_page(pool_flags pf, uint32_t pg_cnt) {
     if (unlikely( pg_cnt <= 0 )) {
@@ -252,25 +290,10 @@ static arena* block2arena(mem_block* b) {
 }
 
 
-void *sys_malloc(uint32_t size) {
-    pool_flags pf;
-    pool *mem_pool;
-    uint32_t pool_size;
-    mem_block_desc *desc;
-    task_struct *cur = running_thread();
-
-    if (cur->pgdir == NULL) {
-        pf = PF_KERNEL;
-        pool_size = kernel_pool.pool_size;
-        mem_pool = &kernel_pool;
-        desc = k_block_descs;
-    }
-    else {
-        pf = PF_USER;
-        pool_size = user_pool.pool_size;
-        mem_pool = &user_pool;
-        desc = cur->u_block_desc;
-    }
+// 从 pf 对应的内存池按 desc 描述的规格分配 size 字节
+static void *block_alloc(pool_flags pf, mem_block_desc *desc, uint32_t size) {
+    pool *mem_pool = pf == PF_KERNEL ? &kernel_pool : &user_pool;
+    uint32_t pool_size = mem_pool->pool_size;
 
     if (!(size > 0 && size < pool_size)) {
         return NULL;
@@ -338,6 +361,21 @@ void *sys_malloc(uint32_t size) {
 }
 
 
+void *sys_malloc(uint32_t size) {
+    task_struct *cur = running_thread();
+    if (cur->pgdir == NULL) {
+        return block_alloc(PF_KERNEL, k_block_descs, size);
+    }
+    return block_alloc(PF_USER, cur->u_block_desc, size);
+}
+
+
+// 不论当前任务是不是用户进程, 都从内核堆中分配
+void *kmalloc(uint32_t size) {
+    return block_alloc(PF_KERNEL, k_block_descs, size);
+}
+
+
 void pfree(uint32_t pg_phy_addr) {
     pool *mem_pool;
     uint32_t bit_idx = 0;
@@ -422,23 +460,14 @@ void mfree_page(pool_flags pf, void* _vaddr, uint32_t pg_cnt) {
 }
 
 
-void sys_free(void *ptr) {
+static void block_free(pool_flags PF, void *ptr) {
     if (ptr == NULL) {
         return;
     }
-    pool_flags PF;
-    pool *mem_pool;
-
-    task_struct *cur = running_thread();
-    if (cur->pgdir == NULL) {
-        PF = PF_KERNEL;
-        mem_pool = &kernel_pool;
+    pool *mem_pool = PF == PF_KERNEL ? &kernel_pool : &user_pool;
+    if (PF == PF_KERNEL) {
         ASSERT((uint32_t)ptr > K_HEAP_START);
     }
-    else {
-        PF = PF_USER;
-        mem_pool = &user_pool;
-    }
     lock_acquire(&mem_pool->lock);
     mem_block *b = ptr;
     arena *a = block2arena(b);
@@ -459,6 +488,17 @@ void sys_free(void *ptr) {
 }
 
 
+void sys_free(void *ptr) {
+    task_struct *cur = running_thread();
+    block_free(cur->pgdir == NULL ? PF_KERNEL : PF_USER, ptr);
+}
+
+
+void kfree(void *ptr) {
+    block_free(PF_KERNEL, ptr);
+}
+
+
 static void mem_pool_init(uint32_t all_mem) {
     put_str("    mem_pool_init start\n");
     uint32_t page_table_size = PG_SIZE * 256;   // 页表大小 = 第 0 和第 768 个页目录项指向同一个页表 +
@@ -516,6 +556,8 @@ static void mem_pool_init(uint32_t all_mem) {
 
     lock_init(&kernel_pool.lock);
     lock_init(&user_pool.lock);
+    lock_register(&kernel_pool.lock, "kernel_pool");
+    lock_register(&user_pool.lock, "user_pool");
 
     // 下面初始化内核虚拟地址的位图,按实际物理内存大小生成数组
     kernel_vaddr.vaddr_bitmap.btmp_bytes_len = kbm_length;
@@ -562,5 +604,6 @@ void mem_init() {
     uint32_t mem_bytes_total = (*(uint32_t*)(0xb00));
     mem_pool_init(mem_bytes_total);     // 初始化内存池
     block_desc_init(k_block_descs);
+    kmap_vaddr = (uint32_t)vaddr_get(PF_KERNEL, 1);
     put_str("mem_init done\n");
 }
@@ -0,0 +1,258 @@
+#include "print.h"
+#include "string.h"
+
+#include "mp.h"
+
+#define LOW_MEM_VADDR(paddr)    ((void *)((uint32_t)(paddr) + 0xc0000000))
+#define LOW_MEM_END             0x100000    // 只有低端 1M 被映射在 0xc0000000 处
+
+#define BDA_EBDA_SEG    0x40e   // BIOS 数据区中 EBDA 段地址所在处
+#define BDA_BASE_MEM_KB 0x413   // BIOS 数据区中基本内存大小 (KB) 所在处
+
+#define MP_ENTRY_CPU        0
+#define MP_ENTRY_BUS        1
+#define MP_ENTRY_IOAPIC     2
+#define MP_ENTRY_IOINTR     3
+#define MP_ENTRY_LINTR      4
+
+#define MP_CPU_ENABLED  (1 << 0)
+#define MP_CPU_BSP      (1 << 1)
+#define MP_IOAPIC_ENABLED (1 << 0)
+#define MP_INTR_TYPE_INT 0      // 向量中断, 其余为 NMI/SMI/ExtINT
+
+#define MP_POL_MASK     0x3
+#define MP_POL_LOW      0x3
+#define MP_TRIG_MASK    0xc
+#define MP_TRIG_LEVEL   0xc
+
+#define MAX_BUS 32
+
+
+// MP 浮动指针结构, 16 字节对齐
+typedef struct __attribute__((packed)) mp_fptr {
+    char signature[4];      // "_MP_"
+    uint32_t config_addr;   // MP 配置表的物理地址
+    uint8_t length;         // 以 16 字节为单位
+    uint8_t spec_rev;
+    uint8_t checksum;
+    uint8_t feature1;       // 非 0 表示使用默认配置, 没有配置表
+    uint8_t feature2;       // bit 7 为 1 表示存在 IMCR
+    uint8_t reserved[3];
+} mp_fptr;
+
+
+// MP 配置表头
+typedef struct __attribute__((packed)) mp_config {
+    char signature[4];      // "PCMP"
+    uint16_t length;
+    uint8_t spec_rev;
+    uint8_t checksum;
+    char oem_id[8];
+    char product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_table_size;
+    uint16_t entry_cnt;
+    uint32_t lapic_addr;
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+} mp_config;
+
+
+typedef struct __attribute__((packed)) mp_cpu_entry {
+    uint8_t type;
+    uint8_t apic_id;
+    uint8_t apic_ver;
+    uint8_t flags;
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+} mp_cpu_entry;
+
+
+typedef struct __attribute__((packed)) mp_bus_entry {
+    uint8_t type;
+    uint8_t bus_id;
+    char bus_type[6];
+} mp_bus_entry;
+
+
+typedef struct __attribute__((packed)) mp_ioapic_entry {
+    uint8_t type;
+    uint8_t apic_id;
+    uint8_t apic_ver;
+    uint8_t flags;
+    uint32_t addr;
+} mp_ioapic_entry;
+
+
+typedef struct __attribute__((packed)) mp_intr_entry {
+    uint8_t type;
+    uint8_t intr_type;
+    uint16_t flags;
+    uint8_t src_bus;
+    uint8_t src_irq;
+    uint8_t dst_apic;
+    uint8_t dst_pin;
+} mp_intr_entry;
+
+
+mp_info mp;
+
+
+static uint8_t sum(const void *addr, uint32_t len) {
+    const uint8_t *p = addr;
+    uint8_t s = 0;
+    for (uint32_t i = 0; i < len; ++i) {
+        s += p[i];
+    }
+    return s;
+}
+
+
+// 在物理地址 [start, start + len) 中按 16 字节对齐查找浮动指针
+static mp_fptr *mp_search(uint32_t start, uint32_t len) {
+    if (start >= LOW_MEM_END) {
+        return NULL;
+    }
+    if (start + len > LOW_MEM_END) {
+        len = LOW_MEM_END - start;
+    }
+    for (uint32_t p = start; p + sizeof(mp_fptr) <= start + len; p += 16) {
+        mp_fptr *fp = LOW_MEM_VADDR(p);
+        if (memcmp(fp->signature, "_MP_", 4) == 0 && sum(fp, sizeof(mp_fptr)) == 0) {
+            return fp;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * 按 MP 规范的顺序查找浮动指针:
+ * 1. EBDA 的第 1KB
+ * 2. 基本内存的最后 1KB
+ * 3. BIOS ROM 0xf0000-0xfffff
+ */
+static mp_fptr *mp_find_fptr(void) {
+    mp_fptr *fp;
+    uint32_t ebda = (uint32_t)(*(uint16_t *)LOW_MEM_VADDR(BDA_EBDA_SEG)) << 4;
+    if (ebda && (fp = mp_search(ebda, 1024)) != NULL) {
+        return fp;
+    }
+    uint32_t base_kb = *(uint16_t *)LOW_MEM_VADDR(BDA_BASE_MEM_KB);
+    if (base_kb && (fp = mp_search(base_kb * 1024 - 1024, 1024)) != NULL) {
+        return fp;
+    }
+    return mp_search(0xf0000, 0x10000);
+}
+
+
+static void mp_parse_entries(mp_config *conf) {
+    bool bus_is_isa[MAX_BUS] = {false};
+    uint8_t *entry = (uint8_t *)(conf + 1);
+    uint8_t *end = (uint8_t *)conf + conf->length;
+
+    while (entry < end) {
+        switch (*entry) {
+        case MP_ENTRY_CPU: {
+            mp_cpu_entry *cpu = (mp_cpu_entry *)entry;
+            if ((cpu->flags & MP_CPU_ENABLED) && mp.cpu_cnt < MAX_CPUS) {
+                if (cpu->flags & MP_CPU_BSP) {
+                    mp.bsp_idx = mp.cpu_cnt;
+                }
+                mp.apic_id[mp.cpu_cnt++] = cpu->apic_id;
+            }
+            entry += sizeof(mp_cpu_entry);
+            break;
+        }
+        case MP_ENTRY_BUS: {
+            mp_bus_entry *bus = (mp_bus_entry *)entry;
+            if (bus->bus_id < MAX_BUS && memcmp(bus->bus_type, "ISA", 3) == 0) {
+                bus_is_isa[bus->bus_id] = true;
+            }
+            entry += sizeof(mp_bus_entry);
+            break;
+        }
+        case MP_ENTRY_IOAPIC: {
+            mp_ioapic_entry *ioapic = (mp_ioapic_entry *)entry;
+            // 只使用第一个 IOAPIC, ISA 中断都接在它上面
+            if ((ioapic->flags & MP_IOAPIC_ENABLED) && !mp.has_ioapic) {
+                mp.has_ioapic = true;
+                mp.ioapic_id = ioapic->apic_id;
+                mp.ioapic_addr = ioapic->addr;
+            }
+            entry += sizeof(mp_ioapic_entry);
+            break;
+        }
+        case MP_ENTRY_IOINTR: {
+            mp_intr_entry *intr = (mp_intr_entry *)entry;
+            // 总线表项总是排在中断表项之前
+            if (intr->intr_type == MP_INTR_TYPE_INT && intr->src_bus < MAX_BUS && \
+                bus_is_isa[intr->src_bus] && intr->src_irq < ISA_IRQ_CNT)
+            {
+                uint8_t irq = intr->src_irq;
+                mp.irq_pin[irq] = intr->dst_pin;
+                mp.irq_flags[irq] = 0;
+                if ((intr->flags & MP_POL_MASK) == MP_POL_LOW) {
+                    mp.irq_flags[irq] |= MP_IRQ_POL_LOW;
+                }
+                if ((intr->flags & MP_TRIG_MASK) == MP_TRIG_LEVEL) {
+                    mp.irq_flags[irq] |= MP_IRQ_TRIG_LEVEL;
+                }
+            }
+            entry += sizeof(mp_intr_entry);
+            break;
+        }
+        case MP_ENTRY_LINTR:
+            entry += 8;
+            break;
+        default:    // 未知表项, 无法得知长度, 放弃后面的表项
+            put_str("    mp: unknown entry type\n");
+            return;
+        }
+    }
+}
+
+
+void mp_init(void) {
+    put_str("\nmp_init start\n");
+    memset(&mp, 0, sizeof(mp));
+    // 默认 ISA IRQ 与 IOAPIC 引脚一一对应, 边沿触发高电平有效
+    for (uint8_t i = 0; i < ISA_IRQ_CNT; ++i) {
+        mp.irq_pin[i] = i;
+    }
+
+    mp_fptr *fp = mp_find_fptr();
+    // 不支持默认配置 (feature1 != 0), 配置表须位于已映射的低端 1M 内
+    if (fp == NULL || fp->feature1 != 0 || fp->config_addr == 0 || \
+        fp->config_addr + sizeof(mp_config) > LOW_MEM_END)
+    {
+        put_str("    no MP table, uniprocessor\n");
+        return;
+    }
+
+    mp_config *conf = LOW_MEM_VADDR(fp->config_addr);
+    if (memcmp(conf->signature, "PCMP", 4) != 0 || \
+        fp->config_addr + conf->length > LOW_MEM_END || \
+        sum(conf, conf->length) != 0)
+    {
+        put_str("    bad MP config table, uniprocessor\n");
+        return;
+    }
+
+    mp.lapic_addr = conf->lapic_addr;
+    mp.imcr = (fp->feature2 & 0x80) != 0;
+    mp_parse_entries(conf);
+    mp.found = mp.cpu_cnt > 0;
+
+    put_str("    cpus: ");
+    put_int(mp.cpu_cnt);
+    put_str(", lapic: 0x");
+    put_int(mp.lapic_addr);
+    if (mp.has_ioapic) {
+        put_str(", ioapic: 0x");
+        put_int(mp.ioapic_addr);
+    }
+    put_str("\nmp_init done\n");
+}
@@ -0,0 +1,148 @@
+#include "tsc.h"
+#include "debug.h"
+#include "global.h"
+#include "interrupt.h"
+#include "stdio_kernel.h"
+
+#include "softirq.h"
+
+#define IRQ_STAT_CNT        0x30    // 只统计 0x00-0x2f 的异常和外部中断
+#define MAX_SOFTIRQ_RESTART 10      // 一次 do_softirq 最多重新检查的轮数, 避免长期占住被中断的任务
+
+#define TIMER_VEC_NO 0x20
+
+
+typedef struct softirq_stat {
+    uint32_t cnt;           // 执行次数
+    uint32_t max_cycles;    // 单次执行的最长时间 (tsc 周期)
+} softirq_stat;
+
+
+static softirq_action *softirq_vec[NR_SOFTIRQS];
+static volatile uint32_t softirq_pending;   // 待处理的软中断位图
+static uint32_t softirq_active;             // 正在执行 (可能中途被调度走) 的软中断位图
+static task_struct *softirq_owner;          // 正在执行 do_softirq 的任务, 防止重入
+
+static softirq_stat bh_stat[NR_SOFTIRQS];   // 下半部的执行统计
+static softirq_stat irq_stat[IRQ_STAT_CNT]; // 上半部 (关中断) 的执行统计
+
+static char *softirq_name[NR_SOFTIRQS] = {"timer", "keyboard", "hd", "ahci", "virtio"};
+
+extern char *intr_name[];
+
+
+void open_softirq(softirq_nr nr, softirq_action action) {
+    ASSERT(nr < NR_SOFTIRQS);
+    softirq_vec[nr] = action;
+}
+
+
+// 标记软中断 nr 待处理, 上半部中调用, 在中断返回前由 irq_exit 执行
+void raise_softirq(softirq_nr nr) {
+    intr_status old_status = intr_disable();
+    softirq_pending |= (1 << nr);
+    intr_set_status(old_status);
+}
+
+
+/**
+ * 在开中断下执行所有待处理的软中断.
+ * 执行期间到来的中断只会置位 softirq_pending, 由本轮循环继续处理.
+ * 本轮尚未开始的软中断记在 cur->softirq_todo 中, 若中途被时钟中断调度走,
+ * softirq_switch_out 会把它们交还 softirq_pending, 由其它任务的中断返回继续执行.
+ * 被打断的那个处理函数仍标记在 softirq_active 中, 本任务回来执行完之前不会被重入.
+ */
+void do_softirq(void) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    task_struct *cur = running_thread();
+    if (softirq_owner != NULL || (softirq_pending & ~softirq_active) == 0) {
+        return;
+    }
+    softirq_owner = cur;
+
+    uint32_t restart = MAX_SOFTIRQ_RESTART;
+    do {
+        cur->softirq_todo = softirq_pending & ~softirq_active;
+        softirq_pending &= ~cur->softirq_todo;
+
+        while (cur->softirq_todo != 0) {
+            uint32_t nr = 0;
+            while (!(cur->softirq_todo & (1 << nr))) {
+                nr++;
+            }
+            cur->softirq_todo &= ~(1 << nr);
+            if (softirq_vec[nr] == NULL) {
+                continue;
+            }
+            softirq_active |= (1 << nr);
+            intr_enable();
+
+            uint32_t start = rdtsc32();
+            softirq_vec[nr]();
+            uint32_t cycles = rdtsc32() - start;
+
+            bh_stat[nr].cnt++;
+            if (cycles > bh_stat[nr].max_cycles) {
+                bh_stat[nr].max_cycles = cycles;
+            }
+
+            intr_disable();
+            softirq_active &= ~(1 << nr);
+        }
+
+        // 中途被调度走过, 剩余的软中断已交给其它任务, 也可能已有新的执行者
+        if (softirq_owner != cur) {
+            return;
+        }
+    } while ((softirq_pending & ~softirq_active) != 0 && --restart);
+
+    softirq_owner = NULL;
+}
+
+
+// schedule 切换走 cur 之前调用, 交出 cur 正在执行的 do_softirq 中尚未开始的软中断
+void softirq_switch_out(task_struct *cur) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    if (softirq_owner != cur) {
+        return;
+    }
+    softirq_pending |= cur->softirq_todo;
+    cur->softirq_todo = 0;
+    softirq_owner = NULL;
+}
+
+
+/**
+ * kernel.S 中的中断入口在处理程序返回后调用此函数.
+ * 先记录上半部的关中断时长, 再执行软中断.
+ * 时钟中断可能在处理程序中调度到其它任务, 其时长没有意义, 故不统计.
+ */
+void irq_exit(uint8_t vec_nr, uint32_t enter_tsc) {
+    if (vec_nr < IRQ_STAT_CNT && vec_nr != TIMER_VEC_NO) {
+        uint32_t cycles = rdtsc32() - enter_tsc;
+        irq_stat[vec_nr].cnt++;
+        if (cycles > irq_stat[vec_nr].max_cycles) {
+            irq_stat[vec_nr].max_cycles = cycles;
+        }
+    }
+    do_softirq();
+}
+
+
+void softirq_stat_print(void) {
+    printk("hard irq (interrupts off):\n");
+    printk("    VEC    COUNT      MAX_CYCLES  NAME\n");
+    for (uint32_t vec_nr = 0; vec_nr < IRQ_STAT_CNT; vec_nr++) {
+        if (irq_stat[vec_nr].cnt != 0) {
+            printk("    0x%x   %d      %d      %s\n",
+                vec_nr, irq_stat[vec_nr].cnt, irq_stat[vec_nr].max_cycles, intr_name[vec_nr]);
+        }
+    }
+
+    printk("softirq (interrupts on):\n");
+    printk("    NR     COUNT      MAX_CYCLES  NAME\n");
+    for (uint32_t nr = 0; nr < NR_SOFTIRQS; nr++) {
+        printk("    %d      %d      %d      %s\n",
+            nr, bh_stat[nr].cnt, bh_stat[nr].max_cycles, softirq_name[nr]);
+    }
+}
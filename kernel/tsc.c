@@ -0,0 +1,50 @@
+#include "print.h"
+#include "debug.h"
+#include "timer.h"
+#include "global.h"
+#include "interrupt.h"
+
+#include "tsc.h"
+
+#define TSC_CALIBRATE_MS 100    // 用 PIT 的 tick 测量 100 毫秒内的 tsc 周期数
+
+
+uint32_t tsc_khz;
+
+
+// 以时钟中断为基准校准 tsc 频率, 须在开中断后调用
+void tsc_init(void) {
+    put_str("\ntsc_init start\n");
+    ASSERT(intr_get_status() == INTR_ON);
+    volatile uint32_t *pticks = &ticks;
+    uint32_t calibrate_ticks = msecs_to_ticks(TSC_CALIBRATE_MS);
+
+    // 从 tick 边界开始计时
+    uint32_t start = *pticks;
+    while (*pticks == start);
+    uint32_t tsc_start = rdtsc32();
+    start = *pticks;
+    while (*pticks - start < calibrate_ticks);
+    tsc_khz = (rdtsc32() - tsc_start) / TSC_CALIBRATE_MS;
+
+    put_str("    tsc khz: 0x");
+    put_int(tsc_khz);
+    put_str("\ntsc_init done\n");
+}
+
+
+// 校准前返回 0
+uint64_t cycles_to_us(uint64_t cycles) {
+    if (tsc_khz == 0) {
+        return 0;
+    }
+    return div_u64_rem(cycles * 1000, tsc_khz, NULL);
+}
+
+
+uint32_t cycles_to_ms(uint64_t cycles) {
+    if (tsc_khz == 0) {
+        return 0;
+    }
+    return (uint32_t)div_u64_rem(cycles, tsc_khz, NULL);
+}
@@ -24,6 +24,18 @@ static inline void outb(uint16_t port, uint8_t data) {
 }
 
 
+// 向端口 port 写入一个字
+static inline void outw(uint16_t port, uint16_t data) {
+    asm volatile ("outw %w0, %w1" : : "a" (data), "Nd" (port));
+}
+
+
+// 向端口 port 写入一个双字
+static inline void outl(uint16_t port, uint32_t data) {
+    asm volatile ("outl %0, %w1" : : "a" (data), "Nd" (port));
+}
+
+
 // 将 addr 处起始的 word_cnt 个字写入端口 port
 static inline void outsw(uint16_t port, const void* addr, uint32_t word_cnt) {
 /*********************************************************
@@ -43,6 +55,22 @@ static inline uint8_t inb(uint16_t port) {
 }
 
 
+// 将从端口 port 读入的一个字返回
+static inline uint16_t inw(uint16_t port) {
+    uint16_t data;
+    asm volatile ("inw %w1, %w0" : "=a" (data) : "Nd" (port));
+    return data;
+}
+
+
+// 将从端口 port 读入的一个双字返回
+static inline uint32_t inl(uint16_t port) {
+    uint32_t data;
+    asm volatile ("inl %w1, %0" : "=a" (data) : "Nd" (port));
+    return data;
+}
+
+
 /* 将从端口port读入的word_cnt个字写入addr */
 static inline void insw(uint16_t port, void* addr, uint32_t word_cnt) {
 /******************************************************
@@ -211,3 +211,64 @@ void pause(void) {
 int32_t ldprog(char *filename, uint32_t file_size) {
     return _syscall2(SYS_LDPROG, filename, file_size);
 }
+
+
+int32_t kstat(const char *name) {
+    return _syscall1(SYS_KSTAT, name);
+}
+
+
+// clone 出的线程在用户态的入口, func 的返回值即线程的退出码
+static void thread_entry(int32_t (*func)(void *), void *arg) {
+    exit(func(arg));
+}
+
+
+pid_t clone(int32_t (*func)(void *), void *arg) {
+    return _syscall3(SYS_CLONE, thread_entry, func, arg);
+}
+
+
+pid_t thread_join(pid_t tid, int32_t *status) {
+    return _syscall2(SYS_THREAD_JOIN, tid, status);
+}
+
+
+int32_t futex_wait(int32_t *addr, int32_t expected) {
+    return _syscall2(SYS_FUTEX_WAIT, addr, expected);
+}
+
+
+int32_t futex_wake(int32_t *addr, uint32_t n) {
+    return _syscall2(SYS_FUTEX_WAKE, addr, n);
+}
+
+
+void top(uint32_t rounds) {
+    _syscall1(SYS_TOP, rounds);
+}
+
+
+int32_t setpriority(pid_t pid, uint32_t prio) {
+    return _syscall2(SYS_SETPRIORITY, pid, prio);
+}
+
+
+int32_t getpriority(pid_t pid) {
+    return _syscall1(SYS_GETPRIORITY, pid);
+}
+
+
+int32_t sched_setdeadline(uint32_t runtime, uint32_t deadline, uint32_t period) {
+    return _syscall3(SYS_SCHED_SETDEADLINE, runtime, deadline, period);
+}
+
+
+int32_t sched_dl_yield(void) {
+    return _syscall0(SYS_SCHED_DL_YIELD);
+}
+
+
+int32_t getrusage(int32_t who, rusage *usage) {
+    return _syscall2(SYS_GETRUSAGE, who, usage);
+}
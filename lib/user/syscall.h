@@ -35,6 +35,17 @@ typedef enum SYSCALL_NR {
     SYS_HELP,
     SYS_PAUSE,
     SYS_LDPROG,
+    SYS_KSTAT,
+    SYS_CLONE,
+    SYS_THREAD_JOIN,
+    SYS_FUTEX_WAIT,
+    SYS_FUTEX_WAKE,
+    SYS_TOP,
+    SYS_SETPRIORITY,
+    SYS_GETPRIORITY,
+    SYS_SCHED_SETDEADLINE,
+    SYS_SCHED_DL_YIELD,
+    SYS_GETRUSAGE,
 
     SYSCALL_NUM,
 } SYSCALL_NR;
@@ -44,6 +55,26 @@ typedef int16_t pid_t;
 typedef struct stat stat;
 
 
+typedef struct timeval {
+    uint32_t tv_sec;
+    uint32_t tv_usec;
+} timeval;
+
+
+#define RUSAGE_SELF     0
+#define RUSAGE_CHILDREN (-1)    // 已被回收的子任务
+
+// getrusage 的结果, cpu 时间由 TSC 精确计量
+typedef struct rusage {
+    timeval  ru_utime;      // 用户态 cpu 时间
+    timeval  ru_stime;      // 内核态 cpu 时间
+    uint64_t ru_ucycles;    // 用户态 cpu 时间, tsc 周期数
+    uint64_t ru_scycles;
+    uint32_t ru_nvcsw;      // 主动让出 cpu 的次数
+    uint32_t ru_nivcsw;     // 被抢占的次数
+} rusage;
+
+
 uint32_t getpid(void);
 uint32_t write(int32_t fd, const void *buf, uint32_t count);
 
@@ -86,5 +117,21 @@ void fd_redirect(uint32_t old_local_fd, uint32_t new_local_fd);
 void help(void);
 void pause(void);
 int32_t ldprog(char *filename, uint32_t file_size);
+int32_t kstat(const char *name);
+
+pid_t clone(int32_t (*func)(void *), void *arg);
+pid_t thread_join(pid_t tid, int32_t *status);
+
+int32_t futex_wait(int32_t *addr, int32_t expected);
+int32_t futex_wake(int32_t *addr, uint32_t n);
+
+void top(uint32_t rounds);
+int32_t setpriority(pid_t pid, uint32_t prio);
+int32_t getpriority(pid_t pid);
+
+int32_t sched_setdeadline(uint32_t runtime, uint32_t deadline, uint32_t period);
+int32_t sched_dl_yield(void);
+
+int32_t getrusage(int32_t who, rusage *usage);
 
 #endif
@@ -0,0 +1,92 @@
+#include "syscall.h"
+
+#include "usync.h"
+
+
+// 若 *addr == old 则写入 new, 返回 *addr 原来的值
+static inline int32_t cmpxchg(volatile int32_t *addr, int32_t old, int32_t new) {
+    int32_t prev;
+    asm volatile ("lock cmpxchgl %2, %1"
+                  : "=a" (prev), "+m" (*addr)
+                  : "r" (new), "0" (old)
+                  : "memory");
+    return prev;
+}
+
+
+static inline int32_t xchg(volatile int32_t *addr, int32_t val) {
+    asm volatile ("xchgl %0, %1" : "+r" (val), "+m" (*addr) : : "memory");
+    return val;
+}
+
+
+static inline int32_t atomic_add(volatile int32_t *addr, int32_t val) {
+    asm volatile ("lock xaddl %0, %1" : "+r" (val), "+m" (*addr) : : "memory");
+    return val;
+}
+
+
+void umutex_init(umutex *m) {
+    m->state = 0;
+}
+
+
+void umutex_lock(umutex *m) {
+    int32_t c = cmpxchg(&m->state, 0, 1);
+    if (c == 0) {
+        return;     // 无竞争, 不进入内核
+    }
+    // 有竞争: 把状态标记为 2 (有等待者) 后睡眠, 醒来再抢;
+    // 抢到时也保持 2, 因为无法确定是否还有其他等待者
+    if (c != 2) {
+        c = xchg(&m->state, 2);
+    }
+    while (c != 0) {
+        futex_wait((int32_t *)&m->state, 2);
+        c = xchg(&m->state, 2);
+    }
+}
+
+
+// 加锁成功返回 0, 锁已被占用返回 -1
+int32_t umutex_trylock(umutex *m) {
+    return cmpxchg(&m->state, 0, 1) == 0 ? 0 : -1;
+}
+
+
+void umutex_unlock(umutex *m) {
+    // 原状态为 1 说明没有等待者, 无需进入内核
+    if (atomic_add(&m->state, -1) != 1) {
+        m->state = 0;
+        futex_wake((int32_t *)&m->state, 1);
+    }
+}
+
+
+void ucond_init(ucond *c) {
+    c->seq = 0;
+}
+
+
+void ucond_wait(ucond *c, umutex *m) {
+    int32_t seq = c->seq;
+    umutex_unlock(m);
+    // 解锁后若已有 signal, seq 已变化, futex_wait 会立即返回
+    futex_wait((int32_t *)&c->seq, seq);
+    // 可能有其他等待者同时被唤醒, 按有竞争的方式加锁
+    while (xchg(&m->state, 2) != 0) {
+        futex_wait((int32_t *)&m->state, 2);
+    }
+}
+
+
+void ucond_signal(ucond *c) {
+    atomic_add(&c->seq, 1);
+    futex_wake((int32_t *)&c->seq, 1);
+}
+
+
+void ucond_broadcast(ucond *c) {
+    atomic_add(&c->seq, 1);
+    futex_wake((int32_t *)&c->seq, 0xffffffff);
+}
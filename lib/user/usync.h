@@ -0,0 +1,32 @@
+#ifndef __LIB_USER_USYNC_H__
+#define __LIB_USER_USYNC_H__
+
+#include "stdint.h"
+
+
+/**
+ * 用户态互斥锁, 无竞争时加解锁不进入内核.
+ * state: 0 未加锁, 1 已加锁且无等待者, 2 已加锁且可能有等待者
+ */
+typedef struct umutex {
+    volatile int32_t state;
+} umutex;
+
+
+// 用户态条件变量, seq 每次 signal/broadcast 加 1, 等待者据此判断是否错过了唤醒
+typedef struct ucond {
+    volatile int32_t seq;
+} ucond;
+
+
+void umutex_init(umutex *m);
+void umutex_lock(umutex *m);
+int32_t umutex_trylock(umutex *m);
+void umutex_unlock(umutex *m);
+
+void ucond_init(ucond *c);
+void ucond_wait(ucond *c, umutex *m);
+void ucond_signal(ucond *c);
+void ucond_broadcast(ucond *c);
+
+#endif
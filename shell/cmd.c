@@ -217,6 +217,38 @@ void buildin_ps(uint32_t argc, char** argv UNUSED) {
 }
 
 
+void buildin_top(uint32_t argc, char** argv) {
+    if (argc > 2) {
+        printf("top: only support 1 argument!\n");
+        return;
+    }
+    top(argc == 2 ? atoi(argv[1]) : 0);
+}
+
+
+/**
+ * 不带参数时打印 shell 的优先级. 带命令时返回命令要使用的优先级 prio, 由调用者在
+ * fork 出的子进程中设置. 普通进程只能降低优先级, prio 不能高于 shell 的优先级.
+ * 无需执行命令或出错返回 -1
+ */
+int32_t buildin_nice(uint32_t argc, char** argv) {
+    if (argc == 1) {
+        printf("%d\n", getpriority(0));
+        return -1;
+    }
+    if (argc < 3) {
+        printf("nice: usage: nice [prio command [args]]\n");
+        return -1;
+    }
+    int32_t prio = atoi(argv[1]);
+    if (prio <= 0 || prio > getpriority(0)) {
+        printf("nice: invalid priority %s, must be 1-%d\n", argv[1], getpriority(0));
+        return -1;
+    }
+    return prio;
+}
+
+
 void buildin_clear(uint32_t argc, char** argv UNUSED) {
     if (argc != 1) {
         printf("clear: no argument support!\n");
@@ -362,3 +394,16 @@ int32_t buildin_ldprog(uint32_t argc, char **argv) {
 
     return 0;
 }
+
+
+int32_t buildin_kstat(uint32_t argc, char **argv) {
+    if (argc != 2) {
+        printf("kstat: only support 1 argument!\n");
+        return -1;
+    }
+    if (kstat(argv[1]) == -1) {
+        printf("kstat: unknown subsystem %s\n", argv[1]);
+        return -1;
+    }
+    return 0;
+}
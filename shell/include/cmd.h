@@ -15,9 +15,12 @@ int32_t buildin_rmdir(uint32_t argc, char** argv);
 
 void buildin_pwd(uint32_t argc, char** argv);
 void buildin_ps(uint32_t argc, char** argv);
+void buildin_top(uint32_t argc, char** argv);
+int32_t buildin_nice(uint32_t argc, char** argv);
 void buildin_clear(uint32_t argc, char** argv);
 
 int32_t buildin_cat(uint32_t argc, char** argv);
 int32_t buildin_ldprog(uint32_t argc, char **argv);
+int32_t buildin_kstat(uint32_t argc, char **argv);
 
 #endif
@@ -19,6 +19,7 @@
 char cwd_cache[CWD_CACHE_LEN] = {0};    // 当前目录的缓存
 char final_path[MAX_PATH_LEN] = {0};    // 用于洗路径时的缓冲
 static char cmd_line[cmd_len] = {0};    // 存储输入的命令
+static int32_t nice_prio = -1;          // nice 为外部命令指定的优先级, -1 表示沿用 shell 的优先级
 
 
 void print_prompt(void) {
@@ -130,6 +131,19 @@ static void cmd_execute(uint32_t argc, char **argv) {
     else if (!strcmp("ps", argv[0])) {
         buildin_ps(argc, argv);
     }
+    else if (!strcmp("top", argv[0])) {
+        buildin_top(argc, argv);
+    }
+    else if (!strcmp("nice", argv[0])) {
+        // 只影响外部命令, 由 fork 出的子进程在 execv 前降低自己的优先级
+        int32_t prio = buildin_nice(argc, argv);
+        if (prio != -1) {
+            nice_prio = prio;
+            cmd_execute(argc - 2, argv + 2);
+            nice_prio = -1;
+            return;
+        }
+    }
     else if (!strcmp("clear", argv[0])) {
         buildin_clear(argc, argv);
         return;
@@ -152,6 +166,9 @@ static void cmd_execute(uint32_t argc, char **argv) {
     else if (!strcmp("ldprog", argv[0])) {
         buildin_ldprog(argc, argv);
     }
+    else if (!strcmp("kstat", argv[0])) {
+        buildin_kstat(argc, argv);
+    }
     // 如果是外部命令, 需要从磁盘上加载
     else {
         int32_t pid = fork();
@@ -177,6 +194,9 @@ static void cmd_execute(uint32_t argc, char **argv) {
                 exit(-1);
             }
             else {
+                if (nice_prio != -1) {
+                    setpriority(0, nice_prio);
+                }
                 execv(argv[0], argv);
             }
         }
@@ -0,0 +1,52 @@
+#include "stdio.h"
+#include "syscall.h"
+
+#define JOBS 50
+#define RUNTIME_MS 30
+#define PERIOD_MS 100
+
+// 每个作业的计算量, 可由第一个参数指定, 应小于 RUNTIME_MS 内能完成的量
+static uint32_t work = 200000;
+
+static void burn(uint32_t loops) {
+    volatile uint32_t i;
+    for (i = 0; i < loops; i++);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        work = atoi(argv[1]);
+    }
+
+    // 带宽超过 95% 的请求应被拒绝
+    if (sched_setdeadline(PERIOD_MS, PERIOD_MS, PERIOD_MS) != -1) {
+        printf("admission control failed: full bandwidth accepted\n");
+        return -1;
+    }
+
+    // 普通优先级的计算任务, 与截止期限任务争抢 cpu
+    pid_t hog = fork();
+    if (hog == 0) {
+        burn(work * JOBS * 4);
+        return 0;
+    }
+
+    if (sched_setdeadline(RUNTIME_MS, PERIOD_MS, PERIOD_MS) == -1) {
+        printf("sched_setdeadline failed\n");
+        return -1;
+    }
+
+    int32_t misses = 0;
+    int32_t i;
+    for (i = 0; i < JOBS; i++) {
+        burn(work);
+        misses = sched_dl_yield();
+    }
+    sched_setdeadline(0, 0, 0);
+
+    int32_t status;
+    wait(&status);
+    printf("edf: %d jobs, runtime %dms, period %dms, deadline misses: %d\n",
+           JOBS, RUNTIME_MS, PERIOD_MS, misses);
+    return misses == 0 ? 0 : 1;
+}
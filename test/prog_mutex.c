@@ -0,0 +1,66 @@
+#include "stdio.h"
+#include "usync.h"
+#include "unistd.h"
+#include "syscall.h"
+
+#define LOOPS 10000
+#define NR_ITEMS 16
+
+static umutex mutex;
+static ucond not_empty;
+static int32_t counter;
+static int32_t items;   // 生产者放入, 消费者取走的物品数
+static int32_t done;
+
+static int32_t producer(void *arg) {
+    int32_t i;
+    for (i = 0; i < LOOPS; i++) {
+        umutex_lock(&mutex);
+        counter++;
+        umutex_unlock(&mutex);
+    }
+    for (i = 0; i < NR_ITEMS; i++) {
+        umutex_lock(&mutex);
+        items++;
+        ucond_signal(&not_empty);
+        umutex_unlock(&mutex);
+    }
+    umutex_lock(&mutex);
+    done = 1;
+    ucond_broadcast(&not_empty);
+    umutex_unlock(&mutex);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    umutex_init(&mutex);
+    ucond_init(&not_empty);
+
+    pid_t tid = clone(producer, NULL);
+    if (tid == -1) {
+        printf("clone failed\n");
+        return -1;
+    }
+
+    int32_t i, consumed = 0;
+    for (i = 0; i < LOOPS; i++) {
+        umutex_lock(&mutex);
+        counter++;
+        umutex_unlock(&mutex);
+    }
+
+    umutex_lock(&mutex);
+    while (!done || items > 0) {
+        while (items == 0 && !done) {
+            ucond_wait(&not_empty, &mutex);
+        }
+        consumed += items;
+        items = 0;
+    }
+    umutex_unlock(&mutex);
+
+    thread_join(tid, NULL);
+    printf("counter: %d (expect %d), consumed: %d (expect %d)\n",
+           counter, 2 * LOOPS, consumed, NR_ITEMS);
+    return 0;
+}
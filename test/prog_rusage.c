@@ -0,0 +1,38 @@
+#include "stdio.h"
+#include "syscall.h"
+
+static void burn(uint32_t loops) {
+    volatile uint32_t i;
+    for (i = 0; i < loops; i++);
+}
+
+static void print_rusage(const char *who, rusage *ru) {
+    printf("%s: user %ds %dus, sys %ds %dus, vcsw %d, ivcsw %d\n", who,
+           ru->ru_utime.tv_sec, ru->ru_utime.tv_usec,
+           ru->ru_stime.tv_sec, ru->ru_stime.tv_usec,
+           ru->ru_nvcsw, ru->ru_nivcsw);
+}
+
+int main(int argc, char **argv) {
+    uint32_t i;
+    rusage ru;
+
+    burn(10000000);             // 用户态时间
+    for (i = 0; i < 10000; i++) {
+        getpid();               // 内核态时间
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        burn(10000000);
+        return 0;
+    }
+    int32_t status;
+    wait(&status);
+
+    getrusage(RUSAGE_SELF, &ru);
+    print_rusage("self", &ru);
+    getrusage(RUSAGE_CHILDREN, &ru);
+    print_rusage("children", &ru);
+    return 0;
+}
@@ -0,0 +1,42 @@
+#include "stdio.h"
+#include "string.h"
+#include "syscall.h"
+
+#define N 1000
+
+static int32_t data[N];
+static int32_t sum[2];
+
+// 两个线程各自累加数组的一半, 结果写回共享的全局变量
+static int32_t worker(void *arg) {
+    int32_t idx = (int32_t)arg;
+    int32_t i;
+    for (i = idx * N / 2; i < (idx + 1) * N / 2; i++) {
+        sum[idx] += data[i];
+    }
+    return idx + 1;
+}
+
+int main(int argc, char **argv) {
+    int32_t i;
+    for (i = 0; i < N; i++) {
+        data[i] = i + 1;
+    }
+
+    pid_t tid[2];
+    for (i = 0; i < 2; i++) {
+        tid[i] = clone(worker, (void *)i);
+        if (tid[i] == -1) {
+            printf("clone failed\n");
+            return -1;
+        }
+    }
+
+    for (i = 0; i < 2; i++) {
+        int32_t ret;
+        thread_join(tid[i], &ret);
+        printf("thread %d return: %d, sum: %d\n", tid[i], ret, sum[i]);
+    }
+    printf("total: %d (expect %d)\n", sum[0] + sum[1], N * (N + 1) / 2);
+    return 0;
+}
@@ -0,0 +1,190 @@
+#include "debug.h"
+#include "timer.h"
+#include "global.h"
+#include "thread.h"
+#include "interrupt.h"
+
+#include "deadline.h"
+
+#define DL_BW_UNIT  1024                        // 带宽的定点单位, 1024 表示占满一个 cpu
+#define DL_BW_LIMIT (DL_BW_UNIT * 95 / 100)     // 截止期限任务的带宽上限, 其余留给普通任务
+
+
+static uint32_t dl_total_bw;    // 已接纳的截止期限任务的带宽之和
+
+
+static inline uint32_t dl_bw(uint32_t runtime, uint32_t period) {
+    return runtime * DL_BW_UNIT / period;
+}
+
+
+// 按绝对截止期限升序插入 rq->dl_ready, 调用者须关中断
+void dl_rq_add(runqueue *rq, task_struct *pthread) {
+    list_elem *elem = rq->dl_ready.head.next;
+    while (elem != &rq->dl_ready.tail) {
+        task_struct *t = elem2entry(task_struct, general_tag, elem);
+        if ((int32_t)(t->dl_abs_deadline - pthread->dl_abs_deadline) > 0) {
+            break;
+        }
+        elem = elem->next;
+    }
+    list_insert_before(elem, &pthread->general_tag);
+}
+
+
+// 进入新周期: 补足预算, 设定截止期限. 落后超过一个周期时从当前时刻重新开始, 不补偿错过的周期
+static void dl_replenish(task_struct *pthread) {
+    if ((int32_t)(ticks - pthread->dl_next_period) >= (int32_t)pthread->dl_period) {
+        pthread->dl_next_period = ticks;
+    }
+    pthread->dl_abs_deadline = pthread->dl_next_period + pthread->dl_deadline;
+    pthread->dl_next_period += pthread->dl_period;
+    pthread->dl_budget = pthread->dl_runtime;
+}
+
+
+// 被节流或等待下一周期的任务在新周期开始时被唤醒
+static void dl_timer_fn(void *data) {
+    task_struct *pthread = (task_struct *)data;
+    intr_status old_status = intr_disable();
+    dl_replenish(pthread);
+    thread_unblock(pthread);
+    intr_set_status(old_status);
+}
+
+
+// 在下一周期开始前阻塞 cur, 须关中断调用, 调用者随后负责调度
+static void dl_wait_next_period(task_struct *cur) {
+    cur->dl_budget = 0;
+    cur->dl_timer.expires = cur->dl_next_period;
+    add_timer(&cur->dl_timer);
+    cur->status = TASK_BLOCKED;
+}
+
+
+// 是否有比 cur 更早截止的截止期限任务就绪, 普通任务总是让位于截止期限任务
+bool dl_should_preempt(task_struct *cur) {
+    list *dl_ready = &thread_rq.dl_ready;
+    if (list_empty(dl_ready)) {
+        return false;
+    }
+    if (cur->policy != SCHED_DEADLINE) {
+        return true;
+    }
+    task_struct *first = elem2entry(task_struct, general_tag, dl_ready->head.next);
+    return (int32_t)(first->dl_abs_deadline - cur->dl_abs_deadline) < 0;
+}
+
+
+/**
+ * 时钟中断中对运行的截止期限任务计费. 预算用完时作业尚未完成,
+ * 由于 deadline <= period, 它必然错过截止期限; 任务被节流到下一周期, 保证普通任务的带宽
+ */
+void dl_task_tick(task_struct *cur) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    if (cur->dl_budget > 0) {
+        cur->dl_budget--;
+    }
+    if (cur->dl_budget == 0) {
+        if (!cur->dl_job_missed) {
+            cur->dl_misses++;
+            cur->dl_job_missed = true;
+        }
+        if ((int32_t)(ticks - cur->dl_next_period) >= 0) {
+            dl_replenish(cur);
+        }
+        else {
+            dl_wait_next_period(cur);
+        }
+        schedule();
+    }
+    else if (dl_should_preempt(cur)) {
+        schedule();
+    }
+}
+
+
+// 任务退出时归还带宽
+void dl_release(task_struct *pthread) {
+    intr_status old_status = intr_disable();
+    if (pthread->policy == SCHED_DEADLINE) {
+        dl_total_bw -= dl_bw(pthread->dl_runtime, pthread->dl_period);
+        del_timer(&pthread->dl_timer);
+        pthread->policy = SCHED_NORMAL;
+    }
+    intr_set_status(old_status);
+}
+
+
+/**
+ * 把调用者设为截止期限任务: 每 period 毫秒需要 runtime 毫秒的 cpu, 须在周期开始后 deadline 毫秒内完成.
+ * 要求 0 < runtime <= deadline <= period, 且所有截止期限任务的带宽之和不超过 95%.
+ * runtime 为 0 时回到普通调度类. 成功返回 0, 未通过接纳控制返回 -1
+ */
+int32_t sys_sched_setdeadline(uint32_t runtime, uint32_t deadline, uint32_t period) {
+    task_struct *cur = running_thread();
+    if (runtime == 0) {
+        dl_release(cur);
+        return 0;
+    }
+
+    uint32_t rt_ticks = msecs_to_ticks(runtime);
+    uint32_t dl_ticks = msecs_to_ticks(deadline);
+    uint32_t period_ticks = msecs_to_ticks(period);
+    if (rt_ticks > dl_ticks || dl_ticks > period_ticks) {
+        return -1;
+    }
+
+    intr_status old_status = intr_disable();
+    uint32_t old_bw = 0;
+    if (cur->policy == SCHED_DEADLINE) {
+        old_bw = dl_bw(cur->dl_runtime, cur->dl_period);
+    }
+    uint32_t bw = dl_bw(rt_ticks, period_ticks);
+    if (dl_total_bw - old_bw + bw > DL_BW_LIMIT) {
+        intr_set_status(old_status);
+        return -1;
+    }
+    dl_total_bw = dl_total_bw - old_bw + bw;
+
+    cur->dl_runtime = rt_ticks;
+    cur->dl_deadline = dl_ticks;
+    cur->dl_period = period_ticks;
+    cur->dl_misses = 0;
+    cur->dl_job_missed = false;
+    cur->dl_timer.function = dl_timer_fn;
+    cur->dl_timer.data = cur;
+    cur->dl_timer.active = false;
+    cur->dl_next_period = ticks;
+    dl_replenish(cur);
+    cur->policy = SCHED_DEADLINE;
+    intr_set_status(old_status);
+    return 0;
+}
+
+
+/**
+ * 截止期限任务完成当前作业: 放弃剩余预算, 睡眠到下一周期开始.
+ * 返回到目前为止错过截止期限的作业数, 调用者不是截止期限任务时返回 -1
+ */
+int32_t sys_sched_dl_yield(void) {
+    task_struct *cur = running_thread();
+    if (cur->policy != SCHED_DEADLINE) {
+        return -1;
+    }
+
+    intr_status old_status = intr_disable();
+    if (!cur->dl_job_missed && (int32_t)(ticks - cur->dl_abs_deadline) > 0) {
+        cur->dl_misses++;
+    }
+    cur->dl_job_missed = false;
+    if ((int32_t)(ticks - cur->dl_next_period) >= 0) {
+        dl_replenish(cur);      // 已经到了下一周期, 直接开始新作业
+    }
+    else {
+        dl_wait_next_period(cur);
+        schedule();
+    }
+    intr_set_status(old_status);
+    return cur->dl_misses;
+}
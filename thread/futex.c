@@ -0,0 +1,107 @@
+#include "list.h"
+#include "print.h"
+#include "debug.h"
+#include "global.h"
+#include "memory.h"
+#include "thread.h"
+#include "interrupt.h"
+
+#include "futex.h"
+
+#define FUTEX_HASH_SIZE 32
+
+
+/**
+ * 等待者挂在自己的内核栈上, 醒来前一直有效.
+ * 以物理地址为键, 共享同一页表的线程和映射同一物理页的进程都能互相唤醒
+ */
+typedef struct futex_waiter {
+    list_elem   tag;
+    uint32_t    key;    // 被等待的 32 位字的物理地址
+    task_struct *task;
+} futex_waiter;
+
+
+static list futex_queues[FUTEX_HASH_SIZE];
+
+
+static inline list *futex_queue(uint32_t key) {
+    return &futex_queues[(key >> 2) % FUTEX_HASH_SIZE];
+}
+
+
+// 检查 uaddr 是否为当前页表中已映射的, 4 字节对齐的用户地址, 合法则返回其物理地址, 否则返回 0
+static uint32_t futex_key(int32_t *uaddr) {
+    uint32_t vaddr = (uint32_t)uaddr;
+    if (vaddr == 0 || vaddr % sizeof(int32_t) != 0 || vaddr >= 0xc0000000) {
+        return 0;
+    }
+    // 先确认页表存在, 再访问 pte, 否则会引发缺页
+    if (!(*pde_vaddr(vaddr) & PG_P_1) || !(*pte_vaddr(vaddr) & PG_P_1)) {
+        return 0;
+    }
+    return addr_v2p(vaddr);
+}
+
+
+/**
+ * 若 *uaddr 仍等于 expected, 则阻塞直到有人对同一地址调用 futex_wake.
+ * 被唤醒返回 0; 值已改变或地址非法返回 -1, 调用者应重新检查条件
+ */
+int32_t sys_futex_wait(int32_t *uaddr, int32_t expected) {
+    uint32_t key = futex_key(uaddr);
+    if (key == 0) {
+        return -1;
+    }
+
+    futex_waiter waiter;
+    waiter.key = key;
+    waiter.task = running_thread();
+
+    // 比较和入队须在关中断下完成, 否则 wake 可能发生在两者之间而丢失
+    intr_status old_status = intr_disable();
+    if (*uaddr != expected) {
+        intr_set_status(old_status);
+        return -1;
+    }
+    list_append(futex_queue(key), &waiter.tag);
+    thread_block(TASK_BLOCKED);
+    intr_set_status(old_status);
+    return 0;
+}
+
+
+// 最多唤醒 n 个在 uaddr 上等待的任务, 返回实际唤醒的个数, 地址非法返回 -1
+int32_t sys_futex_wake(int32_t *uaddr, uint32_t n) {
+    uint32_t key = futex_key(uaddr);
+    if (key == 0) {
+        return -1;
+    }
+
+    int32_t woken = 0;
+    list *queue = futex_queue(key);
+
+    intr_status old_status = intr_disable();
+    list_elem *elem = queue->head.next;
+    while (elem != &queue->tail && (uint32_t)woken < n) {
+        list_elem *next = elem->next;
+        futex_waiter *waiter = elem2entry(futex_waiter, tag, elem);
+        if (waiter->key == key) {
+            list_remove(elem);
+            thread_unblock(waiter->task);
+            woken++;
+        }
+        elem = next;
+    }
+    intr_set_status(old_status);
+    return woken;
+}
+
+
+void futex_init(void) {
+    put_str("\nfutex_init start\n");
+    for (uint32_t i = 0; i < FUTEX_HASH_SIZE; i++) {
+        list_init(&futex_queues[i]);
+    }
+    put_str("futex_init done\n");
+}
@@ -0,0 +1,16 @@
+#ifndef __THREAD_DEADLINE_H__
+#define __THREAD_DEADLINE_H__
+
+#include "stdint.h"
+#include "thread.h"
+
+
+void dl_rq_add(runqueue *rq, task_struct *pthread);
+void dl_task_tick(task_struct *cur);
+bool dl_should_preempt(task_struct *cur);
+void dl_release(task_struct *pthread);
+
+int32_t sys_sched_setdeadline(uint32_t runtime, uint32_t deadline, uint32_t period);
+int32_t sys_sched_dl_yield(void);
+
+#endif
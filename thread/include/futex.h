@@ -0,0 +1,12 @@
+#ifndef __THREAD_FUTEX_H__
+#define __THREAD_FUTEX_H__
+
+#include "stdint.h"
+
+
+void futex_init(void);
+
+int32_t sys_futex_wait(int32_t *uaddr, int32_t expected);
+int32_t sys_futex_wake(int32_t *uaddr, uint32_t n);
+
+#endif
@@ -6,9 +6,10 @@
 #include "thread.h"
 
 
+// 计数信号量, 锁使用其初值为 1 的二元形式
 typedef struct semaphore {
-    uint8_t value;
-    list    waiters;
+    uint32_t value;
+    list     waiters;
 } semaphore;
 
 
@@ -16,16 +17,64 @@ typedef struct lock {
     task_struct *holder;            // 锁的持有者
     semaphore   semaphore;          // 用二元信号量实现锁
     uint32_t    holder_repeat_nr;   // 锁的持有者重复申请锁的次数
+    list_elem   holder_tag;         // 持有者 held_locks 队列中的标记
+
+    // 竞争统计, 只有通过 lock_register 登记过的锁才会出现在报告中
+    const char  *name;
+    list_elem   stat_tag;
+    uint32_t    acquire_cnt;        // 获取次数 (不含重复获取)
+    uint32_t    contended_cnt;      // 获取时锁已被占用的次数
+    uint32_t    wait_ticks;         // 等待锁的总 ticks
 } lock;
 
 
-void sem_init(semaphore *psema, uint8_t value);
+// 条件变量, 必须配合一把锁使用
+typedef struct condvar {
+    list waiters;
+} condvar;
+
+
+typedef enum rwlock_pref {
+    RWLOCK_PREFER_READER,   // 只要没有写者持锁, 新读者即可进入, 写者可能饥饿
+    RWLOCK_PREFER_WRITER    // 有写者在等待时, 新读者也要等待
+} rwlock_pref;
+
+
+// 读写锁, 允许多个读者同时持有
+typedef struct rwlock {
+    rwlock_pref pref;
+    uint32_t    readers;        // 持有锁的读者数
+    task_struct *writer;        // 持有锁的写者
+    list        read_waiters;
+    list        write_waiters;
+} rwlock;
+
+
+void sem_init(semaphore *psema, uint32_t value);
 void sem_wait(semaphore *psema);
+void sem_wait_io(semaphore *psema);
+bool sem_trywait(semaphore *psema);
 void sem_post(semaphore *psema);
 
 void lock_init(lock *plock);
+void lock_register(lock *plock, const char *name);
 void lock_acquire(lock *plock);
 void lock_release(lock *plock);
+void priority_update(task_struct *pthread);
+
+void lock_stat_init(void);
+void lock_stat_print(void);
+
+void cond_init(condvar *cond);
+void cond_wait(condvar *cond, lock *plock);
+void cond_signal(condvar *cond);
+void cond_broadcast(condvar *cond);
+
+void rwlock_init(rwlock *rw, rwlock_pref pref);
+void read_lock(rwlock *rw);
+void read_unlock(rwlock *rw);
+void write_lock(rwlock *rw);
+void write_unlock(rwlock *rw);
 
 
 #endif
@@ -5,11 +5,21 @@
 #include "stdint.h"
 #include "bitmap.h"
 #include "memory.h"
+#include "timer.h"
 
 #define TASK_NAME_LEN   16
+#define PRIO_MIN        1   // 优先级即时间片的 tick 数
+#define PRIO_MAX        63
 #define MAX_FILES_OPEN_PER_PROC 8
 
 typedef int16_t pid_t;
+
+
+typedef enum sched_policy {
+    SCHED_NORMAL,   // 按优先级轮转
+    SCHED_DEADLINE  // 最早截止期限优先 (EDF), 总是先于普通任务调度
+} sched_policy;
+
 typedef void thread_func(void *);
 
 
@@ -67,36 +77,92 @@ typedef struct thread_stack {
 } thread_stack;
 
 
+// 同一进程中各线程共享的资源, 最后一个使用者退出时释放
+typedef struct task_group {
+    uint32_t users;                             // 共享此结构的任务数
+    int8_t fd_table[MAX_FILES_OPEN_PER_PROC];
+    mem_block_desc u_block_desc[DESC_CNT];      // 用户堆的内存块描述符
+} task_group;
+
+
 typedef struct task_struct {
     uint32_t *self_kstack;  // 各内核线程都用自己的内核栈
     pid_t pid;
     task_status status;
     char name[TASK_NAME_LEN];
 
-    uint8_t priority;
+    uint8_t priority;       // 有效优先级, 可能因优先级继承而高于 base_priority
+    uint8_t base_priority;  // 创建时指定的优先级
     uint8_t ticks;
     uint32_t elapsed_ticks;
 
-    int8_t fd_table[MAX_FILES_OPEN_PER_PROC];
+    // 调度统计, 由 top 显示
+    uint32_t nvcsw;         // 主动让出 cpu (阻塞, yield) 的次数
+    uint32_t nivcsw;        // 时间片用完被抢占的次数
+    uint32_t ready_since;   // 最近一次进入就绪队列时的 ticks
+    uint32_t wait_ticks;    // 在就绪队列中等待的总 ticks
+    uint32_t iowait_ticks;  // 阻塞等待 I/O 完成的总 ticks
+    uint32_t top_ticks;     // top 上次采样时的 elapsed_ticks
+    uint32_t softirq_todo;  // 正在执行的 do_softirq 中本轮尚未开始的软中断
+
+    // 由 TSC 精确计量的 cpu 时间, 单位为 tsc 周期
+    uint64_t acct_tsc;      // 上次计时的时间戳
+    uint64_t utime;         // 用户态时间
+    uint64_t stime;         // 内核态时间, idle 任务的即为 cpu 空闲时间
+    uint64_t cutime;        // 已回收的子任务的用户态时间之和
+    uint64_t cstime;
+
+    // 截止期限调度类的参数和状态, 时间单位为 tick
+    sched_policy policy;
+    uint32_t dl_runtime;        // 每个周期的运行时间预算
+    uint32_t dl_deadline;       // 相对于周期开始的截止期限
+    uint32_t dl_period;
+    uint32_t dl_budget;         // 当前作业剩余的预算
+    uint32_t dl_abs_deadline;   // 当前作业的绝对截止期限
+    uint32_t dl_next_period;    // 下一个周期开始时的 ticks
+    uint32_t dl_misses;         // 错过截止期限的作业数
+    bool dl_job_missed;         // 当前作业是否已计入 dl_misses
+    timer_list dl_timer;        // 节流或等待下一周期时用于唤醒
+
+    int8_t *fd_table;       // 指向 group->fd_table
 
     list_elem general_tag;
     list_elem all_list_tag;
+    list_elem pid_hash_tag;     // pid 哈希表中的标记
+    list_elem child_tag;        // 父进程 children 或 zombie_children 队列中的标记
 
-    uint32_t *pgdir;                // 进程自己页表的虚拟地址
-    virtual_addr userprog_vaddr;    // 用户进程的虚拟地址
-    mem_block_desc u_block_desc[DESC_CNT];
+    uint32_t *pgdir;                // 进程自己页表的虚拟地址, 同一进程的线程相同
+    virtual_addr userprog_vaddr;    // 用户进程的虚拟地址, 位图由同一进程的线程共享
+    mem_block_desc *u_block_desc;   // 指向 group->u_block_desc
+    task_group *group;
+    void *ustack;                   // clone 出的线程自己的用户栈页, 进程主线程为 NULL
 
     uint32_t cwd_inode_nr;  // 进程所在的工作目录的 inode 编号
     pid_t parent_pid;       // 父进程 pid
+    list children;          // 尚未退出的子进程
+    list zombie_children;   // 已退出 (TASK_HANGING) 等待回收的子进程
     uint8_t exit_status;    // 返回值
+    void *fpu_state;        // FXSAVE 区域, 首次使用 FPU 时分配
+    list held_locks;        // 持有的锁, 用于释放锁后重新计算继承来的优先级
+    struct lock *blocked_on;    // 正在等待的锁, 用于沿持有链传递优先级
     uint32_t stack_magic;   // 用这串数字做栈的边界标记, 用于检测栈的溢出
 } task_struct;
 
 
+// 就绪队列, 只有 BSP 调度任务, 以关中断互斥
+typedef struct runqueue {
+    list ready;
+    list dl_ready;      // 截止期限调度类的就绪任务, 按绝对截止期限升序排列
+} runqueue;
+
+
 extern list thread_all_list;
-extern list thread_ready_list;
+extern runqueue thread_rq;
 
 void sys_ps(void);
+void sys_top(uint32_t rounds);
+int32_t sys_setpriority(pid_t pid, uint32_t prio);
+int32_t sys_getpriority(pid_t pid);
 pid_t fork_pid(void);
 
 void init_thread(task_struct *pthread, char *name, int prio);
@@ -107,12 +173,21 @@ task_struct *running_thread(void);
 void schedule(void);
 void thread_init(void);
 
+void rq_enqueue(task_struct *pthread, bool at_head);
+bool rq_dequeue(task_struct *pthread);
+void wake_up_new_task(task_struct *pthread);
+
 void thread_block(task_status stat);
 void thread_unblock(task_struct *pthread);
 void thread_yield(void);
 
 void thread_exit(task_struct *thread_over, bool need_schedule);
+
+task_group *task_group_create(void);
+void task_group_attach(task_struct *pthread, task_group *group);
+uint32_t task_group_put(task_struct *pthread);
 task_struct* pid2thread(pid_t pid);
+void pid_hash_add(task_struct *pthread);
 void release_pid(pid_t pid);
 
 #endif
@@ -0,0 +1,71 @@
+#ifndef __THREAD_WORKQUEUE_H__
+#define __THREAD_WORKQUEUE_H__
+
+#include "list.h"
+#include "timer.h"
+#include "stdint.h"
+#include "thread.h"
+
+#define WQ_NAME_LEN 12
+#define WQ_MAX_WORKERS 4
+
+
+typedef void work_func(void *arg);
+
+
+// 工作项由调用者提供内存, 在执行完成 (或 flush_work 返回) 之前不能释放
+typedef struct work_struct {
+    work_func *func;
+    void *arg;
+    list_elem work_tag;         // 用于 workqueue 的 worklist
+    struct workqueue *wq;       // 最近一次排入的队列
+    bool pending;               // 已排队尚未开始执行
+    bool running;               // 正在被 worker 执行
+    uint32_t queued_tsc;        // 排队时的 tsc, 用于统计排队延迟
+    task_struct *flush_waiter;  // 在 flush_work 中等待此工作项完成的线程
+} work_struct;
+
+
+// 延迟工作项, 到期后由定时器排入队列
+typedef struct delayed_work {
+    work_struct work;
+    timer_list timer;
+} delayed_work;
+
+
+// 工作队列: 固定数量的内核线程从 worklist 中取出工作项执行
+typedef struct workqueue {
+    char name[WQ_NAME_LEN];
+    list worklist;              // 待执行的工作项
+    list idle_workers;          // 空闲的 worker
+    uint32_t nr_workers;
+    list_elem wq_tag;           // 用于全局的 workqueue_list
+
+    // 统计信息
+    uint32_t queued;            // 累计排队次数
+    uint32_t completed;         // 累计完成次数
+    uint32_t depth;             // 当前排队深度
+    uint32_t max_depth;         // 最大排队深度
+    uint32_t max_latency;       // 排队到开始执行的最长时间 (tsc 周期)
+    uint32_t avg_latency;       // 排队延迟的指数滑动平均 (tsc 周期)
+} workqueue;
+
+
+extern workqueue *system_wq;
+
+void init_work(work_struct *work, work_func func, void *arg);
+void init_delayed_work(delayed_work *dwork, work_func func, void *arg);
+
+workqueue *create_workqueue(const char *name, uint32_t nr_workers);
+bool queue_work(workqueue *wq, work_struct *work);
+bool queue_delayed_work(workqueue *wq, delayed_work *dwork, uint32_t m_seconds);
+bool cancel_delayed_work(delayed_work *dwork);
+void flush_work(work_struct *work);
+
+bool schedule_work(work_struct *work);
+bool schedule_delayed_work(delayed_work *dwork, uint32_t m_seconds);
+
+void workqueue_stat_print(void);
+void workqueue_init(void);
+
+#endif
@@ -1,12 +1,20 @@
 #include "list.h"
+#include "print.h"
 #include "debug.h"
+#include "timer.h"
 #include "global.h"
 #include "interrupt.h"
+#include "stdio_kernel.h"
 
 #include "sync.h"
 
+#define MAX_DONATE_DEPTH 8  // 优先级沿持有链传递的最大深度
 
-void sem_init(semaphore *psema, uint8_t value) {
+
+static list lock_stat_list; // 登记了名字的锁, 用于打印竞争报告
+
+
+void sem_init(semaphore *psema, uint32_t value) {
     psema->value = value;
     list_init(&psema->waiters);
 }
@@ -16,6 +24,31 @@ void lock_init(lock *plock) {
     plock->holder = NULL;
     plock->holder_repeat_nr = 0;
     sem_init(&plock->semaphore, 1);
+    plock->name = NULL;
+    plock->acquire_cnt = plock->contended_cnt = plock->wait_ticks = 0;
+}
+
+
+// 登记长期存在的锁, 使其出现在竞争报告中. 随内存释放的锁 (如管道的锁) 不能登记
+void lock_register(lock *plock, const char *name) {
+    plock->name = name;
+    list_append(&lock_stat_list, &plock->stat_tag);
+}
+
+
+// 返回 waiters 中优先级最高的任务, 优先级相同时先等待者优先
+static list_elem *highest_prio_waiter(list *waiters) {
+    list_elem *best = waiters->head.next;
+    task_struct *first = elem2entry(task_struct, general_tag, best);
+    uint8_t best_prio = first->priority;
+    for (list_elem *elem = best->next; elem != &waiters->tail; elem = elem->next) {
+        task_struct *pthread = elem2entry(task_struct, general_tag, elem);
+        if (pthread->priority > best_prio) {
+            best = elem;
+            best_prio = pthread->priority;
+        }
+    }
+    return best;
 }
 
 
@@ -28,29 +61,132 @@ void sem_wait(semaphore *psema) {
         thread_block(TASK_BLOCKED);
     }
     psema->value--;
-    ASSERT(psema->value == 0);
     intr_set_status(old_status);
 }
 
 
+// 等待 I/O 完成的 P 操作, 阻塞的时间计入当前任务的 iowait_ticks
+void sem_wait_io(semaphore *psema) {
+    task_struct *cur = running_thread();
+    uint32_t start = ticks;
+    sem_wait(psema);
+    cur->iowait_ticks += ticks - start;
+}
+
+
+// 不阻塞地尝试 P 操作, 成功返回 true
+bool sem_trywait(semaphore *psema) {
+    intr_status old_status = intr_disable();
+    bool ret = false;
+    if (psema->value > 0) {
+        psema->value--;
+        ret = true;
+    }
+    intr_set_status(old_status);
+    return ret;
+}
+
+
 void sem_post(semaphore *psema) {
     intr_status old_status = intr_disable();
-    ASSERT(psema->value == 0);
     if (!list_empty(&psema->waiters)) {
-        task_struct *thread_blocked = elem2entry(task_struct, general_tag, list_pop(&psema->waiters));
-        thread_unblock(thread_blocked);
+        list_elem *waiter = highest_prio_waiter(&psema->waiters);
+        list_remove(waiter);
+        thread_unblock(elem2entry(task_struct, general_tag, waiter));
     }
     psema->value++;
-    ASSERT(psema->value == 1);
     intr_set_status(old_status);
 }
 
 
+/**
+ * 把 prio 捐赠给 plock 的持有者, 若持有者也在等待别的锁, 则继续沿持有链传递.
+ * 就绪的持有者被移到就绪队列队首, 尽快运行以释放锁.
+ */
+static void priority_donate(lock *plock, uint8_t prio) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    for (uint32_t depth = 0; plock != NULL && depth < MAX_DONATE_DEPTH; depth++) {
+        task_struct *holder = plock->holder;
+        if (holder == NULL || holder->priority >= prio) {
+            break;
+        }
+        holder->priority = prio;
+        if (holder->ticks < prio) {
+            holder->ticks = prio;
+        }
+        if (holder->status == TASK_READY && rq_dequeue(holder)) {
+            rq_enqueue(holder, true);
+        }
+        plock = holder->blocked_on;
+    }
+}
+
+
+// 释放锁后, 按仍持有的锁上的等待者重新计算有效优先级
+static void priority_restore(task_struct *pthread) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    uint8_t prio = pthread->base_priority;
+    list *held = &pthread->held_locks;
+    for (list_elem *l = held->head.next; l != &held->tail; l = l->next) {
+        lock *held_lock = elem2entry(lock, holder_tag, l);
+        list *waiters = &held_lock->semaphore.waiters;
+        for (list_elem *w = waiters->head.next; w != &waiters->tail; w = w->next) {
+            task_struct *waiter = elem2entry(task_struct, general_tag, w);
+            if (waiter->priority > prio) {
+                prio = waiter->priority;
+            }
+        }
+    }
+    pthread->priority = prio;
+}
+
+
+/**
+ * pthread 的基础优先级被修改后调用: 重新计算其有效优先级, 若它正在等锁,
+ * 再沿持有链重新计算各持有者的有效优先级, 使之前捐赠的优先级随之升高或降低.
+ */
+void priority_update(task_struct *pthread) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    task_struct *target = pthread;
+    for (uint32_t depth = 0; pthread != NULL && depth <= MAX_DONATE_DEPTH; depth++) {
+        uint8_t old_prio = pthread->priority;
+        priority_restore(pthread);
+        if (pthread != target && pthread->priority == old_prio) {
+            break;
+        }
+        // 被提升的持有者与 priority_donate 中一样移到队首, 其余按新优先级排到队尾
+        bool raised = pthread != target && pthread->priority > old_prio;
+        if (raised && pthread->ticks < pthread->priority) {
+            pthread->ticks = pthread->priority;
+        }
+        if (pthread->status == TASK_READY && rq_dequeue(pthread)) {
+            rq_enqueue(pthread, raised);
+        }
+        pthread = pthread->blocked_on == NULL ? NULL : pthread->blocked_on->holder;
+    }
+}
+
+
 void lock_acquire(lock *plock) {
     task_struct *cur = running_thread();
     if (plock->holder != cur) {
-        sem_wait(&plock->semaphore);
+        intr_status old_status = intr_disable();
+        plock->acquire_cnt++;
+        if (plock->semaphore.value == 0) {
+            plock->contended_cnt++;
+            uint32_t start_tick = ticks;
+            cur->blocked_on = plock;
+            priority_donate(plock, cur->priority);
+            sem_wait(&plock->semaphore);
+            cur->blocked_on = NULL;
+            plock->wait_ticks += ticks - start_tick;
+        }
+        else {
+            sem_wait(&plock->semaphore);
+        }
         plock->holder = cur;
+        list_append(&cur->held_locks, &plock->holder_tag);
+        intr_set_status(old_status);
         ASSERT(plock->holder_repeat_nr == 0);
         plock->holder_repeat_nr = 1;
     }
@@ -61,16 +197,177 @@ void lock_acquire(lock *plock) {
 
 
 void lock_release(lock *plock) {
-#ifndef NDEBUG
     task_struct *cur = running_thread();
-#endif
     ASSERT(plock->holder == cur);
     if (plock->holder_repeat_nr > 1) {
         plock->holder_repeat_nr--;
         return;
     }
     ASSERT(plock->holder_repeat_nr == 1);
+
+    intr_status old_status = intr_disable();
+    list_remove(&plock->holder_tag);
     plock->holder = NULL;
     plock->holder_repeat_nr = 0;
+    if (cur->priority != cur->base_priority) {
+        priority_restore(cur);
+    }
     sem_post(&plock->semaphore);
+    intr_set_status(old_status);
+}
+
+
+static bool lock_info(list_elem *pelem, int arg UNUSED) {
+    lock *plock = elem2entry(lock, stat_tag, pelem);
+    printk("    %s  acquire: %d  contended: %d  wait_ticks: %d  holder: %d\n",
+        plock->name, plock->acquire_cnt, plock->contended_cnt, plock->wait_ticks,
+        plock->holder == NULL ? -1 : plock->holder->pid);
+    return false;
+}
+
+
+// 须在任何子系统登记锁之前调用
+void lock_stat_init(void) {
+    put_str("\nlock_stat_init start\n");
+    list_init(&lock_stat_list);
+    put_str("lock_stat_init done\n");
+}
+
+
+void lock_stat_print(void) {
+    printk("lock contention:\n");
+    if (lock_stat_list.head.next != NULL) {
+        list_traversal(&lock_stat_list, lock_info, 0);
+    }
+}
+
+
+void cond_init(condvar *cond) {
+    list_init(&cond->waiters);
+}
+
+
+/**
+ * 释放 plock 并阻塞, 被唤醒后重新获取 plock 再返回.
+ * 释放锁和加入等待队列在关中断下完成, 不会丢失两者之间的唤醒.
+ * 返回后条件未必成立, 调用者应在循环中重新检查
+ */
+void cond_wait(condvar *cond, lock *plock) {
+    task_struct *cur = running_thread();
+    ASSERT(plock->holder == cur && plock->holder_repeat_nr == 1);
+
+    intr_status old_status = intr_disable();
+    ASSERT(!elem_find(&cond->waiters, &cur->general_tag));
+    list_append(&cond->waiters, &cur->general_tag);
+    lock_release(plock);
+    thread_block(TASK_BLOCKED);
+    intr_set_status(old_status);
+
+    lock_acquire(plock);
+}
+
+
+// 唤醒一个等待者
+void cond_signal(condvar *cond) {
+    intr_status old_status = intr_disable();
+    if (!list_empty(&cond->waiters)) {
+        list_elem *waiter = highest_prio_waiter(&cond->waiters);
+        list_remove(waiter);
+        thread_unblock(elem2entry(task_struct, general_tag, waiter));
+    }
+    intr_set_status(old_status);
+}
+
+
+// 唤醒所有等待者
+void cond_broadcast(condvar *cond) {
+    intr_status old_status = intr_disable();
+    while (!list_empty(&cond->waiters)) {
+        thread_unblock(elem2entry(task_struct, general_tag, list_pop(&cond->waiters)));
+    }
+    intr_set_status(old_status);
+}
+
+
+void rwlock_init(rwlock *rw, rwlock_pref pref) {
+    rw->pref = pref;
+    rw->readers = 0;
+    rw->writer = NULL;
+    list_init(&rw->read_waiters);
+    list_init(&rw->write_waiters);
+}
+
+
+/**
+ * 把锁直接交给队首的写者后再唤醒它.
+ * 若只是唤醒, 在它重新上 cpu 之前新来的读者或写者会看到锁空闲而抢先进入
+ */
+static void rwlock_handoff(rwlock *rw) {
+    task_struct *writer = elem2entry(task_struct, general_tag, list_pop(&rw->write_waiters));
+    rw->writer = writer;
+    thread_unblock(writer);
+}
+
+
+void read_lock(rwlock *rw) {
+    task_struct *cur = running_thread();
+    intr_status old_status = intr_disable();
+    ASSERT(rw->writer != cur);
+    while (rw->writer != NULL || \
+           (rw->pref == RWLOCK_PREFER_WRITER && !list_empty(&rw->write_waiters)))
+    {
+        list_append(&rw->read_waiters, &cur->general_tag);
+        thread_block(TASK_BLOCKED);
+    }
+    rw->readers++;
+    intr_set_status(old_status);
+}
+
+
+void read_unlock(rwlock *rw) {
+    intr_status old_status = intr_disable();
+    ASSERT(rw->readers > 0 && rw->writer == NULL);
+    // 最后一个读者离开时把锁直接交给一个写者
+    if (--rw->readers == 0 && !list_empty(&rw->write_waiters)) {
+        rwlock_handoff(rw);
+    }
+    intr_set_status(old_status);
+}
+
+
+void write_lock(rwlock *rw) {
+    task_struct *cur = running_thread();
+    intr_status old_status = intr_disable();
+    ASSERT(rw->writer != cur);
+    if (rw->writer != NULL || rw->readers > 0) {
+        list_append(&rw->write_waiters, &cur->general_tag);
+        thread_block(TASK_BLOCKED);
+        // 被唤醒时锁已由 rwlock_handoff 交给本任务
+        ASSERT(rw->writer == cur);
+    }
+    else {
+        rw->writer = cur;
+    }
+    intr_set_status(old_status);
+}
+
+
+// 写者释放时按偏好决定把锁交给一个写者还是唤醒全部读者
+void write_unlock(rwlock *rw) {
+    intr_status old_status = intr_disable();
+    ASSERT(rw->writer == running_thread());
+    rw->writer = NULL;
+
+    bool wake_writer = !list_empty(&rw->write_waiters) && \
+        (rw->pref == RWLOCK_PREFER_WRITER || list_empty(&rw->read_waiters));
+
+    if (wake_writer) {
+        rwlock_handoff(rw);
+    }
+    else {
+        while (!list_empty(&rw->read_waiters)) {
+            thread_unblock(elem2entry(task_struct, general_tag, list_pop(&rw->read_waiters)));
+        }
+    }
+    intr_set_status(old_status);
 }
@@ -1,20 +1,32 @@
 #include "fs.h"
 #include "sync.h"
+#include "fpu.h"
+#include "tsc.h"
 #include "file.h"
 #include "debug.h"
 #include "print.h"
 #include "stdio.h"
+#include "timer.h"
 #include "stdint.h"
 #include "global.h"
 #include "memory.h"
 #include "string.h"
 #include "process.h"
+#include "softirq.h"
+#include "cputime.h"
+#include "deadline.h"
+#include "ioqueue.h"
+#include "keyboard.h"
 #include "interrupt.h"
 
 #include "thread.h"
 
 
 #define PG_SIZE 4096
+#define PID_HASH_BUCKETS 64     // pid 哈希桶数, 必须是 2 的幂
+#define pid_hashfn(pid) ((uint32_t)(pid) & (PID_HASH_BUCKETS - 1))
+#define TOP_INTERVAL_MS 1000    // top 的刷新间隔
+#define STARVE_TICKS 100        // 在就绪队列中等待超过 1 秒的任务优先调度
 
 
 // pid 的位图, 最大支持 1024 个 pid
@@ -30,9 +42,9 @@ struct pid_pool {
 
 task_struct *main_thread;       // 主线程 PCB
 task_struct *idle_thread;       // idle 线程
-list thread_ready_list;         // 就绪队列
 list thread_all_list;           // 所有任务队列
-static list_elem *thread_tag;   // 用于保存队列中的线程结点
+runqueue thread_rq;             // 就绪队列
+static list pid_hash[PID_HASH_BUCKETS]; // pid 到 pcb 的哈希表, 避免遍历 thread_all_list
 
 
 extern void switch_to(task_struct *cur, task_struct *next);
@@ -62,6 +74,7 @@ static void pid_pool_init(void) {
     pid_pool.pid_bitmap.btmp_bytes_len = 128;
     bitmap_init(&pid_pool.pid_bitmap);
     lock_init(&pid_pool.pid_lock);
+    lock_register(&pid_pool.pid_lock, "pid_pool");
 }
 
 
@@ -126,20 +139,67 @@ void init_thread(task_struct *pthread, char *name, int prio) {
     pthread->self_kstack = (uint32_t *)((uint32_t)pthread + PG_SIZE);
 
     pthread->priority = prio;
+    pthread->base_priority = prio;
     pthread->ticks = prio;
     pthread->elapsed_ticks = 0;
+    pthread->acct_tsc = rdtsc64();
     pthread->pgdir = NULL;
 
-    pthread->fd_table[0] = 0;
-    pthread->fd_table[1] = 1;
-    pthread->fd_table[2] = 2;
-    for (int i = 3; i < MAX_FILES_OPEN_PER_PROC; ++i) {
-        pthread->fd_table[i] = -1;
-    }
-
     pthread->cwd_inode_nr = 0;  // 默认工作目录是根目录
     pthread->parent_pid = -1;
+    list_init(&pthread->children);
+    list_init(&pthread->zombie_children);
+    list_init(&pthread->held_locks);
+    pthread->blocked_on = NULL;
     pthread->stack_magic = 0x19780506;
+
+    // 分配内存会用到锁, 须在 held_locks 初始化之后
+    task_group *group = task_group_create();
+    ASSERT(group != NULL);
+    task_group_attach(pthread, group);
+}
+
+
+// 创建只有标准输入输出的 task_group, 引用计数为 0, 由 task_group_attach 增加
+task_group *task_group_create(void) {
+    task_group *group = kmalloc(sizeof(task_group));
+    if (group == NULL) {
+        return NULL;
+    }
+    group->users = 0;
+    group->fd_table[0] = 0;
+    group->fd_table[1] = 1;
+    group->fd_table[2] = 2;
+    for (int i = 3; i < MAX_FILES_OPEN_PER_PROC; ++i) {
+        group->fd_table[i] = -1;
+    }
+    block_desc_init(group->u_block_desc);
+    return group;
+}
+
+
+void task_group_attach(task_struct *pthread, task_group *group) {
+    intr_status old_status = intr_disable();
+    group->users++;
+    intr_set_status(old_status);
+    pthread->group = group;
+    pthread->fd_table = group->fd_table;
+    pthread->u_block_desc = group->u_block_desc;
+}
+
+
+/**
+ * 解除 pthread 与其 group 的关联, 返回 group 剩余的使用者数.
+ * 返回 0 时调用者须先释放 group 中的文件等资源, 再 kfree group
+ */
+uint32_t task_group_put(task_struct *pthread) {
+    task_group *group = pthread->group;
+    ASSERT(group != NULL && group->users > 0);
+    intr_status old_status = intr_disable();
+    uint32_t users = --group->users;
+    intr_set_status(old_status);
+    pthread->group = NULL;
+    return users;
 }
 
 
@@ -149,11 +209,12 @@ task_struct* thread_start(char* name, int prio, thread_func function, void* func
     init_thread(thread, name, prio);
     thread_create(thread, function, func_arg);
 
-    ASSERT(!elem_find(&thread_ready_list, &thread->general_tag));
-    list_append(&thread_ready_list, &thread->general_tag);
-
+    intr_status old_status = intr_disable();
     ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
     list_append(&thread_all_list, &thread->all_list_tag);
+    pid_hash_add(thread);
+    wake_up_new_task(thread);
+    intr_set_status(old_status);
 
     return thread;
 }
@@ -167,6 +228,76 @@ static void make_main_thread(void) {
 
     ASSERT(!elem_find(&thread_all_list, &main_thread->all_list_tag));
     list_append(&thread_all_list, &main_thread->all_list_tag);
+    pid_hash_add(main_thread);
+}
+
+
+// 以下几个函数要求调用者已关中断
+/**
+ * 就绪队列按有效优先级降序排列, 高优先级任务先被调度.
+ * at_head 时排在同优先级任务之前 (如刚被唤醒的任务), 否则排在其后
+ */
+static void rq_add(runqueue *rq, task_struct *pthread, bool at_head) {
+    ASSERT(!elem_find(&rq->ready, &pthread->general_tag));
+    if (pthread->policy == SCHED_DEADLINE) {
+        dl_rq_add(rq, pthread);
+        pthread->ready_since = ticks;
+        return;
+    }
+    list_elem *elem = rq->ready.head.next;
+    while (elem != &rq->ready.tail) {
+        task_struct *t = elem2entry(task_struct, general_tag, elem);
+        if (t->priority < pthread->priority || (at_head && t->priority == pthread->priority)) {
+            break;
+        }
+        elem = elem->next;
+    }
+    list_insert_before(elem, &pthread->general_tag);
+    pthread->ready_since = ticks;
+}
+
+
+// 把 pthread 加入就绪队列
+void rq_enqueue(task_struct *pthread, bool at_head) {
+    intr_status old_status = intr_disable();
+    rq_add(&thread_rq, pthread, at_head);
+    intr_set_status(old_status);
+}
+
+
+// 选出下一个运行的任务: 通常是队首, 但在队列中等待过久的任务优先, 防止低优先级任务饿死
+static task_struct *rq_pick(runqueue *rq) {
+    if (!list_empty(&rq->dl_ready)) {
+        task_struct *earliest = elem2entry(task_struct, general_tag, rq->dl_ready.head.next);
+        return earliest;
+    }
+    for (list_elem *elem = rq->ready.head.next; elem != &rq->ready.tail; elem = elem->next) {
+        task_struct *pthread = elem2entry(task_struct, general_tag, elem);
+        if (ticks - pthread->ready_since >= STARVE_TICKS) {
+            return pthread;
+        }
+    }
+    task_struct *first = elem2entry(task_struct, general_tag, rq->ready.head.next);
+    return first;
+}
+
+
+// 若 pthread 在就绪队列中则将其移出, 返回是否移出
+bool rq_dequeue(task_struct *pthread) {
+    intr_status old_status = intr_disable();
+    bool found = elem_find(&thread_rq.ready, &pthread->general_tag) ||
+                 elem_find(&thread_rq.dl_ready, &pthread->general_tag);
+    if (found) {
+        list_remove(&pthread->general_tag);
+    }
+    intr_set_status(old_status);
+    return found;
+}
+
+
+// 新创建的任务加入就绪队列
+void wake_up_new_task(task_struct *pthread) {
+    rq_enqueue(pthread, false);
 }
 
 
@@ -174,25 +305,36 @@ void schedule() {
     ASSERT(intr_get_status() == INTR_OFF);
 
     task_struct *cur = running_thread();
+    runqueue *rq = &thread_rq;
+
     if (cur->status == TASK_RUNNING) {
-        ASSERT(!elem_find(&thread_ready_list, &cur->general_tag));
-        list_append(&thread_ready_list, &cur->general_tag);
+        rq_add(rq, cur, false);
         cur->ticks = cur->priority;
         cur->status = TASK_READY;
+        cur->nivcsw++;
+    }
+    else {
+        cur->nvcsw++;
     }
 
     // 如果就绪队列中没有可运行的任务, 就唤醒 idle
-    if (list_empty(&thread_ready_list)) {
-        thread_unblock(idle_thread);
+    if (list_empty(&rq->ready) && list_empty(&rq->dl_ready)) {
+        ASSERT(idle_thread->status == TASK_BLOCKED);
+        idle_thread->status = TASK_READY;
+        rq_add(rq, idle_thread, true);
     }
 
-    thread_tag = NULL;      // thread_tag 清空
-    // 将 thread_ready_list 队列中的第一个就绪线程弹出, 准备将其调度上 cpu.
-    thread_tag = list_pop(&thread_ready_list);
-    task_struct *next = elem2entry(task_struct, general_tag, thread_tag);
+    task_struct *next = rq_pick(rq);
+    list_remove(&next->general_tag);
     next->status = TASK_RUNNING;
+    next->wait_ticks += ticks - next->ready_since;
 
+    if (next != cur) {
+        softirq_switch_out(cur);
+    }
     process_activate(next);
+    fpu_switch_to(next);
+    acct_switch(cur, next);
     switch_to(cur, next);
 }
 
@@ -209,6 +351,9 @@ static void pad_print(char* buf, int32_t buf_len, void* ptr, char format) {
         __attribute__((fallthrough));
     case 'x':
         out_pad_0idx = sprintf(buf, "%x", *((uint32_t*)ptr));
+        break;
+    case 'u':
+        out_pad_0idx = sprintf(buf, "%d", *((uint32_t*)ptr));
     }
     while(out_pad_0idx < buf_len) { // 以空格填充
         buf[out_pad_0idx] = ' ';
@@ -222,35 +367,40 @@ static bool elem2thread_info(struct list_elem* pelem, int arg UNUSED) {
     task_struct *pthread = elem2entry(task_struct, all_list_tag, pelem);
     char out_pad[16] = {0};
 
-    pad_print(out_pad, 16, &pthread->pid, 'd');
+    pad_print(out_pad, 9, &pthread->pid, 'd');
 
     if (pthread->parent_pid == -1) {
-        pad_print(out_pad, 16, "NULL", 's');
+        pad_print(out_pad, 9, "NULL", 's');
     }
     else {
-        pad_print(out_pad, 16, &pthread->parent_pid, 'd');
+        pad_print(out_pad, 9, &pthread->parent_pid, 'd');
     }
 
     switch (pthread->status) {
     case 0:
-        pad_print(out_pad, 16, "RUNNING", 's');
+        pad_print(out_pad, 11, "RUNNING", 's');
         break;
     case 1:
-        pad_print(out_pad, 16, "READY", 's');
+        pad_print(out_pad, 11, "READY", 's');
         break;
     case 2:
-        pad_print(out_pad, 16, "BLOCKED", 's');
+        pad_print(out_pad, 11, "BLOCKED", 's');
         break;
     case 3:
-        pad_print(out_pad, 16, "WAITING", 's');
+        pad_print(out_pad, 11, "WAITING", 's');
         break;
     case 4:
-        pad_print(out_pad, 16, "HANGING", 's');
+        pad_print(out_pad, 11, "HANGING", 's');
         break;
     case 5:
-        pad_print(out_pad, 16, "DIED", 's');
+        pad_print(out_pad, 11, "DIED", 's');
     }
-    pad_print(out_pad, 16, &pthread->elapsed_ticks, 'x');
+    pad_print(out_pad, 11, &pthread->elapsed_ticks, 'x');
+
+    uint32_t ms = cycles_to_ms(pthread->utime);
+    pad_print(out_pad, 13, &ms, 'u');
+    ms = cycles_to_ms(pthread->stime);
+    pad_print(out_pad, 13, &ms, 'u');
 
     memset(out_pad, 0, 16);
     ASSERT(strlen(pthread->name) < 17);
@@ -264,31 +414,152 @@ static bool elem2thread_info(struct list_elem* pelem, int arg UNUSED) {
 
 
 void sys_ps(void) {
-    char* ps_title = "PID            PPID           STAT           TICKS          COMMAND\n";
+    char* ps_title = "PID     PPID    STAT      TICKS     UTIME(ms)   STIME(ms)   COMMAND\n";
     sys_write(stdout_no, ps_title, strlen(ps_title));
     list_traversal(&thread_all_list, elem2thread_info, 0);
 }
 
 
+static const char *status_name[] = {"RUNNING", "READY", "BLOCKED", "WAITING", "HANGING", "DIED"};
+
+
+static bool top_sample(list_elem *pelem, int arg UNUSED) {
+    task_struct *pthread = elem2entry(task_struct, all_list_tag, pelem);
+    pthread->top_ticks = pthread->elapsed_ticks;
+    return false;
+}
+
+
+// 打印一个任务在最近 interval 个 ticks 内的 cpu 占用率及累计的调度统计
+static bool elem2top_info(list_elem *pelem, int interval) {
+    task_struct *pthread = elem2entry(task_struct, all_list_tag, pelem);
+    char out_pad[16] = {0};
+    uint32_t val;
+
+    val = pthread->pid;
+    pad_print(out_pad, 6, &val, 'u');
+    val = pthread->elapsed_ticks - pthread->top_ticks;
+    pthread->top_ticks = pthread->elapsed_ticks;
+    val = val * 100 / interval;
+    pad_print(out_pad, 6, &val, 'u');
+    pad_print(out_pad, 9, (void *)status_name[pthread->status], 's');
+    pad_print(out_pad, 8, &pthread->elapsed_ticks, 'u');
+    pad_print(out_pad, 8, &pthread->nvcsw, 'u');
+    pad_print(out_pad, 8, &pthread->nivcsw, 'u');
+    pad_print(out_pad, 8, &pthread->wait_ticks, 'u');
+    pad_print(out_pad, 8, &pthread->iowait_ticks, 'u');
+
+    memset(out_pad, 0, 16);
+    memcpy(out_pad, pthread->name, strlen(pthread->name));
+    strcat(out_pad, "\n");
+    sys_write(stdout_no, out_pad, strlen(out_pad));
+    return false;
+}
+
+
+/**
+ * 每秒刷新一次各任务的 cpu 占用率和调度统计, 时间单位为 tick.
+ * 刷新 rounds 次后返回, rounds 为 0 时一直刷新到有按键为止
+ */
+void sys_top(uint32_t rounds) {
+    char* top_title = "PID  CPU% STAT    TICKS  VCSW   IVCSW  WAIT   IOWAIT COMMAND\n";
+    char header[80];
+
+    list_traversal(&thread_all_list, top_sample, 0);
+    uint32_t last = ticks;
+    for (uint32_t round = 0; rounds == 0 || round < rounds; round++) {
+        msleep(TOP_INTERVAL_MS);
+        if (rounds == 0 && !ioq_empty(&kbd_buf)) {
+            ioq_getchar(&kbd_buf);
+            break;
+        }
+        uint32_t interval = ticks - last;
+        last = ticks;
+
+        cls_screen();
+        sprintf(header, "top - ticks %d, %d tasks, press any key to quit\n\n",
+                ticks, list_len(&thread_all_list));
+        sys_write(stdout_no, header, strlen(header));
+        sys_write(stdout_no, top_title, strlen(top_title));
+        list_traversal(&thread_all_list, elem2top_info, interval);
+    }
+}
+
+
+/**
+ * 设置任务 pid (0 表示调用者自己) 的基础优先级, 它既是调度顺序也是时间片的 tick 数.
+ * 用户进程只能修改自己, 自己的子进程和同一进程中的线程, 且只能降低基础优先级;
+ * 内核线程不受限制. 有效优先级和沿持有链捐赠出去的优先级随之重新计算. 失败返回 -1
+ */
+int32_t sys_setpriority(pid_t pid, uint32_t prio) {
+    if (prio < PRIO_MIN || prio > PRIO_MAX) {
+        return -1;
+    }
+    task_struct *cur = running_thread();
+    intr_status old_status = intr_disable();
+    task_struct *pthread = pid == 0 ? cur : pid2thread(pid);
+    if (pthread == NULL) {
+        intr_set_status(old_status);
+        return -1;
+    }
+    if (cur->pgdir != NULL) {
+        bool related = pthread == cur || pthread->parent_pid == cur->pid || pthread->group == cur->group;
+        if (!related || prio > pthread->base_priority) {
+            intr_set_status(old_status);
+            return -1;
+        }
+    }
+    pthread->base_priority = prio;
+    priority_update(pthread);
+    if (pthread->ticks > pthread->priority) {
+        pthread->ticks = pthread->priority;
+    }
+    intr_set_status(old_status);
+    return 0;
+}
+
+
+// 返回任务 pid (0 表示调用者自己) 的基础优先级, 任务不存在返回 -1
+int32_t sys_getpriority(pid_t pid) {
+    intr_status old_status = intr_disable();
+    task_struct *pthread = pid == 0 ? running_thread() : pid2thread(pid);
+    int32_t prio = pthread == NULL ? -1 : pthread->base_priority;
+    intr_set_status(old_status);
+    return prio;
+}
+
+
 void thread_exit(task_struct *thread_over, bool need_schedule) {
     intr_status old_status = intr_disable();
     thread_over->status = TASK_DIED;
 
-    if (elem_find(&thread_ready_list, &thread_over->general_tag)) {
-        list_remove(&thread_over->general_tag);
-    }
+    rq_dequeue(thread_over);
     if (thread_over->pgdir) {
         mfree_page(PF_KERNEL, thread_over->pgdir, 1);
     }
 
     list_remove(&thread_over->all_list_tag);
+    list_remove(&thread_over->pid_hash_tag);
+    fpu_release(thread_over);
+    dl_release(thread_over);
+
+    // 用户进程已在 sys_exit 中解除了关联, 这里处理的是内核线程
+    if (thread_over->group != NULL) {
+        task_group *group = thread_over->group;
+        if (task_group_put(thread_over) == 0) {
+            kfree(group);
+        }
+    }
+
+    // pcb 所在页释放后便不能再访问, 先取出 pid
+    pid_t pid = thread_over->pid;
 
     // main_thread 不在 pcb 堆中
     if (thread_over != main_thread) {
         mfree_page(PF_KERNEL, thread_over, 1);
     }
 
-    release_pid(thread_over->pid);
+    release_pid(pid);
 
     if (need_schedule) {
         schedule();
@@ -302,7 +573,7 @@ void thread_exit(task_struct *thread_over, bool need_schedule) {
 
 static bool pid_check(list_elem* pelem, int pid) {
     pid = (pid_t)pid;
-    task_struct *pthread = elem2entry(task_struct, all_list_tag, pelem);
+    task_struct *pthread = elem2entry(task_struct, pid_hash_tag, pelem);
     if (pthread->pid == pid) {
         return true;
     }
@@ -310,20 +581,33 @@ static bool pid_check(list_elem* pelem, int pid) {
 }
 
 
+// 将 pthread 加入 pid 哈希表, 须在 pthread 加入 thread_all_list 时一并调用
+void pid_hash_add(task_struct *pthread) {
+    list *bucket = &pid_hash[pid_hashfn(pthread->pid)];
+    ASSERT(!elem_find(bucket, &pthread->pid_hash_tag));
+    list_append(bucket, &pthread->pid_hash_tag);
+}
+
+
+// 只遍历 pid 所在的哈希桶, 而非整个 thread_all_list
 task_struct* pid2thread(pid_t pid) {
-    list_elem *pelem = list_traversal(&thread_all_list, pid_check, pid);
+    list_elem *pelem = list_traversal(&pid_hash[pid_hashfn(pid)], pid_check, pid);
     if (pelem == NULL) {
         return NULL;
     }
-    task_struct *thread = elem2entry(task_struct, all_list_tag, pelem);
+    task_struct *thread = elem2entry(task_struct, pid_hash_tag, pelem);
     return thread;
 }
 
 
 void thread_init(void) {
     put_str("\nthread_init start\n");
-    list_init(&thread_ready_list);
+    list_init(&thread_rq.ready);
+    list_init(&thread_rq.dl_ready);
     list_init(&thread_all_list);
+    for (int i = 0; i < PID_HASH_BUCKETS; ++i) {
+        list_init(&pid_hash[i]);
+    }
     pid_pool_init();
 
     make_main_thread();
@@ -347,8 +631,7 @@ void thread_unblock(task_struct *pthread) {
     intr_status old_stat = intr_disable();
     ASSERT((pthread->status == TASK_BLOCKED) || (pthread->status == TASK_WAITING) || (pthread->status == TASK_HANGING));
     if (pthread->status != TASK_READY) {
-        ASSERT(!elem_find(&thread_ready_list, &pthread->general_tag));
-        list_push(&thread_ready_list, &pthread->general_tag);
+        rq_enqueue(pthread, true);
         pthread->status = TASK_READY;
     }
     intr_set_status(old_stat);
@@ -358,8 +641,7 @@ void thread_unblock(task_struct *pthread) {
 void thread_yield(void) {
     task_struct *cur = running_thread();
     intr_status old_status = intr_disable();
-    ASSERT(!elem_find(&thread_ready_list, &cur->general_tag));
-    list_append(&thread_ready_list, &cur->general_tag);
+    rq_enqueue(cur, false);
     cur->status = TASK_READY;
     schedule();
     intr_set_status(old_status);
@@ -0,0 +1,210 @@
+#include "tsc.h"
+#include "debug.h"
+#include "print.h"
+#include "stdio.h"
+#include "global.h"
+#include "memory.h"
+#include "string.h"
+#include "interrupt.h"
+#include "stdio_kernel.h"
+
+#include "workqueue.h"
+
+#define WORKER_PRIO 31
+#define SYSTEM_WQ_WORKERS 2
+
+
+workqueue *system_wq;           // 默认的工作队列
+static list workqueue_list;     // 所有工作队列, 用于打印统计信息
+
+
+void init_work(work_struct *work, work_func func, void *arg) {
+    memset(work, 0, sizeof(*work));
+    work->func = func;
+    work->arg = arg;
+}
+
+
+void init_delayed_work(delayed_work *dwork, work_func func, void *arg) {
+    init_work(&dwork->work, func, arg);
+    memset(&dwork->timer, 0, sizeof(dwork->timer));
+}
+
+
+// worker 线程: 取出工作项执行, 队列为空时阻塞在 idle_workers 上
+static void worker_thread(void *arg) {
+    workqueue *wq = (workqueue *)arg;
+    task_struct *cur = running_thread();
+
+    while (1) {
+        intr_status old_status = intr_disable();
+        while (list_empty(&wq->worklist)) {
+            ASSERT(!elem_find(&wq->idle_workers, &cur->general_tag));
+            list_append(&wq->idle_workers, &cur->general_tag);
+            thread_block(TASK_BLOCKED);
+        }
+
+        work_struct *work = elem2entry(work_struct, work_tag, list_pop(&wq->worklist));
+        work->pending = false;
+        work->running = true;
+        wq->depth--;
+
+        uint32_t latency = rdtsc32() - work->queued_tsc;
+        if (latency > wq->max_latency) {
+            wq->max_latency = latency;
+        }
+        wq->avg_latency = wq->avg_latency - (wq->avg_latency >> 3) + (latency >> 3);
+        intr_set_status(old_status);
+
+        work->func(work->arg);
+
+        old_status = intr_disable();
+        work->running = false;
+        wq->completed++;
+        // 执行期间又被排入队列的, 等下一次执行完成后再唤醒
+        if (!work->pending && work->flush_waiter != NULL) {
+            thread_unblock(work->flush_waiter);
+            work->flush_waiter = NULL;
+        }
+        intr_set_status(old_status);
+    }
+}
+
+
+workqueue *create_workqueue(const char *name, uint32_t nr_workers) {
+    ASSERT(nr_workers > 0 && nr_workers <= WQ_MAX_WORKERS);
+    ASSERT(strlen(name) < WQ_NAME_LEN);
+
+    workqueue *wq = (workqueue *)sys_malloc(sizeof(workqueue));
+    if (wq == NULL) {
+        return NULL;
+    }
+    strcpy(wq->name, name);
+    list_init(&wq->worklist);
+    list_init(&wq->idle_workers);
+    wq->nr_workers = nr_workers;
+
+    // worker 线程名为 "队列名/编号"
+    char worker_name[TASK_NAME_LEN];
+    for (uint32_t i = 0; i < nr_workers; i++) {
+        sprintf(worker_name, "%s/%d", name, i);
+        thread_start(worker_name, WORKER_PRIO, worker_thread, wq);
+    }
+
+    intr_status old_status = intr_disable();
+    list_append(&workqueue_list, &wq->wq_tag);
+    intr_set_status(old_status);
+    return wq;
+}
+
+
+/**
+ * 将 work 排入 wq, 可在中断及软中断上下文中调用.
+ * 若 work 已在排队则不重复排入, 返回 false
+ */
+bool queue_work(workqueue *wq, work_struct *work) {
+    intr_status old_status = intr_disable();
+    if (work->pending) {
+        intr_set_status(old_status);
+        return false;
+    }
+    work->pending = true;
+    work->wq = wq;
+    work->queued_tsc = rdtsc32();
+    list_append(&wq->worklist, &work->work_tag);
+
+    wq->queued++;
+    if (++wq->depth > wq->max_depth) {
+        wq->max_depth = wq->depth;
+    }
+
+    if (!list_empty(&wq->idle_workers)) {
+        task_struct *worker = elem2entry(task_struct, general_tag, list_pop(&wq->idle_workers));
+        thread_unblock(worker);
+    }
+    intr_set_status(old_status);
+    return true;
+}
+
+
+static void delayed_work_timer_fn(void *data) {
+    delayed_work *dwork = (delayed_work *)data;
+    queue_work(dwork->work.wq, &dwork->work);
+}
+
+
+// m_seconds 毫秒后将 dwork 排入 wq, 若已在等待定时器或已排队则返回 false
+bool queue_delayed_work(workqueue *wq, delayed_work *dwork, uint32_t m_seconds) {
+    if (m_seconds == 0) {
+        return queue_work(wq, &dwork->work);
+    }
+
+    intr_status old_status = intr_disable();
+    if (dwork->timer.active || dwork->work.pending) {
+        intr_set_status(old_status);
+        return false;
+    }
+    dwork->work.wq = wq;
+    dwork->timer.expires = ticks + msecs_to_ticks(m_seconds);
+    dwork->timer.function = delayed_work_timer_fn;
+    dwork->timer.data = dwork;
+    add_timer(&dwork->timer);
+    intr_set_status(old_status);
+    return true;
+}
+
+
+// 取消尚未到期的延迟工作项, 已排队或正在执行的不受影响
+bool cancel_delayed_work(delayed_work *dwork) {
+    intr_status old_status = intr_disable();
+    bool active = dwork->timer.active;
+    del_timer(&dwork->timer);
+    intr_set_status(old_status);
+    return active;
+}
+
+
+// 等待 work 执行完毕, 若 work 既未排队也未在执行则立即返回. 不能在 worker 中等待自己
+void flush_work(work_struct *work) {
+    intr_status old_status = intr_disable();
+    if (work->pending || work->running) {
+        ASSERT(work->flush_waiter == NULL);
+        work->flush_waiter = running_thread();
+        thread_block(TASK_BLOCKED);
+    }
+    intr_set_status(old_status);
+}
+
+
+bool schedule_work(work_struct *work) {
+    return queue_work(system_wq, work);
+}
+
+
+bool schedule_delayed_work(delayed_work *dwork, uint32_t m_seconds) {
+    return queue_delayed_work(system_wq, dwork, m_seconds);
+}
+
+
+static bool workqueue_info(list_elem *pelem, int arg UNUSED) {
+    workqueue *wq = elem2entry(workqueue, wq_tag, pelem);
+    printk("    %s  workers: %d  queued: %d  completed: %d  depth: %d  max_depth: %d\n",
+        wq->name, wq->nr_workers, wq->queued, wq->completed, wq->depth, wq->max_depth);
+    printk("        latency (cycles) max: %d  avg: %d\n", wq->max_latency, wq->avg_latency);
+    return false;
+}
+
+
+void workqueue_stat_print(void) {
+    printk("workqueues:\n");
+    list_traversal(&workqueue_list, workqueue_info, 0);
+}
+
+
+void workqueue_init(void) {
+    put_str("\nworkqueue_init start\n");
+    list_init(&workqueue_list);
+    system_wq = create_workqueue("events", SYSTEM_WQ_WORKERS);
+    ASSERT(system_wq != NULL);
+    put_str("workqueue_init done\n");
+}
@@ -26,4 +26,4 @@ nasm -I ${src_path}/include/ -o ${work_path}/out/loader.bin ${src_path}/loader.S
 
 gcc -g -m32 -c -o ${work_path}/out/main.o ${work_path}/test/boot_test_main.c && \
     ld ${work_path}/out/main.o -Ttext 0xc0001500 -m elf_i386 -e main -o ${work_path}/out/kernel.bin && \
-    dd if=${work_path}/out/kernel.bin of=${work_path}/hd60M.img bs=512 count=200 seek=9 conv=notrunc
+    dd if=${work_path}/out/kernel.bin of=${work_path}/hd60M.img bs=512 count=376 seek=9 conv=notrunc
@@ -55,5 +55,5 @@ SEC_CNT=$(ls -l $DD_IN | cut -d ' ' -f 5)
 echo -e "It take $SEC_CNT bytes.\n"
 
 if [[ -f $DD_IN ]]; then
-    dd if=$DD_IN of=$DD_OUT bs=512 count=$SEC_CNT seek=300 conv=notrunc
+    dd if=$DD_IN of=$DD_OUT bs=512 count=$SEC_CNT seek=400 conv=notrunc
 fi
@@ -0,0 +1,100 @@
+#include "fs.h"
+#include "debug.h"
+#include "global.h"
+#include "memory.h"
+#include "thread.h"
+#include "process.h"
+#include "cputime.h"
+#include "interrupt.h"
+
+#include "clone.h"
+
+
+// 新线程第一次上 cpu 时从这里进入用户态, 参数和返回地址已由 sys_clone 压入用户栈
+static void start_user_thread(void *entry) {
+    task_struct *cur = running_thread();
+    jump_to_user(entry, (void *)((uint32_t)cur->ustack + PG_SIZE - 3 * sizeof(uint32_t)));
+}
+
+
+/**
+ * 创建与当前进程共享页表, 用户虚拟地址池, 用户堆和文件表的线程.
+ * 新线程在用户态从 entry(func, arg) 开始执行, entry 由用户库提供,
+ * 负责调用 func(arg) 并在其返回后 exit. 新线程是调用者的子任务, 用 thread_join 回收.
+ * 成功返回新线程的 pid, 失败返回 -1
+ */
+pid_t sys_clone(void *entry, void *func, void *arg) {
+    task_struct *cur = running_thread();
+    if (cur->pgdir == NULL) {   // 只有用户进程可以创建线程
+        return -1;
+    }
+
+    task_struct *thread = (task_struct *)get_kernel_pages(1);
+    if (thread == NULL) {
+        return -1;
+    }
+    // 用户栈从共享的用户虚拟地址池中分配, 新线程自己的用户栈就在当前页表中可见
+    uint32_t *ustack = get_user_pages(1);
+    if (ustack == NULL) {
+        mfree_page(PF_KERNEL, thread, 1);
+        return -1;
+    }
+
+    init_thread(thread, cur->name, cur->base_priority);
+    kfree(thread->group);   // init_thread 分配的 group 刚创建, 未被共享
+    task_group_attach(thread, cur->group);
+    thread->pgdir = cur->pgdir;
+    thread->userprog_vaddr = cur->userprog_vaddr;
+    thread->ustack = ustack;
+    thread->cwd_inode_nr = cur->cwd_inode_nr;
+    thread->parent_pid = cur->pid;
+
+    // cdecl 调用 entry(func, arg) 时的栈: 返回地址 (不会用到), func, arg
+    uint32_t *top = (uint32_t *)((uint32_t)ustack + PG_SIZE);
+    top[-1] = (uint32_t)arg;
+    top[-2] = (uint32_t)func;
+    top[-3] = 0;
+
+    thread_create(thread, start_user_thread, entry);
+    add_cwd(thread->cwd_inode_nr);
+
+    intr_status old_status = intr_disable();
+    list_append(&cur->children, &thread->child_tag);
+    ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
+    list_append(&thread_all_list, &thread->all_list_tag);
+    pid_hash_add(thread);
+    wake_up_new_task(thread);
+    intr_set_status(old_status);
+
+    return thread->pid;
+}
+
+
+/**
+ * 等待子任务 tid (一般是 sys_clone 创建的线程) 退出并回收, 退出码存入 status.
+ * tid 不是调用者的子任务时返回 -1
+ */
+pid_t sys_thread_join(pid_t tid, int32_t *status) {
+    task_struct *cur = running_thread();
+    task_struct *child = pid2thread(tid);
+    if (child == NULL || child->parent_pid != cur->pid) {
+        return -1;
+    }
+
+    while (1) {
+        // 检查和阻塞须在关中断下完成, 子任务退出时的唤醒才不会丢失
+        intr_status old_status = intr_disable();
+        if (child->status == TASK_HANGING) {
+            list_remove(&child->child_tag);
+            intr_set_status(old_status);
+            if (status != NULL) {
+                *status = child->exit_status;
+            }
+            acct_reap(cur, child);
+            thread_exit(child, false);
+            return tid;
+        }
+        thread_block(TASK_WAITING);
+        intr_set_status(old_status);
+    }
+}
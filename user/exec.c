@@ -1,4 +1,5 @@
 #include "fs.h"
+#include "fpu.h"
 #include "thread.h"    
 #include "string.h"
 #include "global.h"
@@ -160,6 +161,11 @@ done:
 
 
 int32_t sys_execv(const char* path, const char* argv[]) {
+    // 其它线程仍在使用当前地址空间, 不能替换
+    if (running_thread()->group->users > 1) {
+        return -1;
+    }
+
     uint32_t argc = 0;
     while (argc < MAX_ARG_NR && argv[argc]) {
         argc++;
@@ -173,6 +179,9 @@ int32_t sys_execv(const char* path, const char* argv[]) {
 
     task_struct *cur = running_thread();
 
+    // 新程序从干净的 FPU 状态开始
+    fpu_reset(cur);
+
     // 修改进程名
     memcpy(cur->name, path, TASK_NAME_LEN);
     cur->name[TASK_NAME_LEN - 1] = 0;
@@ -1,4 +1,5 @@
 #include "fs.h"
+#include "fpu.h"
 #include "file.h"
 #include "pipe.h"
 #include "debug.h"
@@ -18,12 +19,32 @@ static int32_t copy_pcb_vaddrbitmap_stack0(task_struct *child_thread, task_struc
     memcpy(child_thread, parent_thread, PG_SIZE);
     child_thread->pid = fork_pid();
     child_thread->elapsed_ticks = 0;
+    child_thread->nvcsw = child_thread->nivcsw = 0;
+    child_thread->wait_ticks = child_thread->iowait_ticks = 0;
+    child_thread->top_ticks = 0;
+    child_thread->utime = child_thread->stime = 0;
+    child_thread->cutime = child_thread->cstime = 0;
+    child_thread->policy = SCHED_NORMAL;    // 截止期限参数和带宽不继承
     child_thread->status = TASK_READY;
+    child_thread->priority = child_thread->base_priority;   // 不继承父进程临时提升的优先级
     child_thread->ticks = child_thread->priority;
     child_thread->parent_pid = parent_thread->pid;
     child_thread->general_tag.prev = child_thread->general_tag.next = NULL;
     child_thread->all_list_tag.prev = child_thread->all_list_tag.next = NULL;
-    block_desc_init(child_thread->u_block_desc);
+    child_thread->pid_hash_tag.prev = child_thread->pid_hash_tag.next = NULL;
+    child_thread->child_tag.prev = child_thread->child_tag.next = NULL;
+    list_init(&child_thread->children);     // memcpy 复制来的是父进程的队列, 需重新初始化
+    list_init(&child_thread->zombie_children);
+    list_init(&child_thread->held_locks);
+    child_thread->blocked_on = NULL;
+
+    // memcpy 复制来的 group 属于父进程, 子进程复制一份文件表, 用户堆描述符重新初始化
+    task_group *group = task_group_create();
+    if (group == NULL) {
+        return -1;
+    }
+    memcpy(group->fd_table, parent_thread->fd_table, sizeof(group->fd_table));
+    task_group_attach(child_thread, group);
 
     uint32_t bitmap_pg_cnt = DIV_ROUND_UP((0xc0000000 - USER_VADDR_START) / PG_SIZE / 8 , PG_SIZE);
     void *vaddr_btmp = get_kernel_pages(bitmap_pg_cnt);
@@ -33,6 +54,11 @@ static int32_t copy_pcb_vaddrbitmap_stack0(task_struct *child_thread, task_struc
 
     memcpy(vaddr_btmp, parent_thread->userprog_vaddr.vaddr_bitmap.bits, bitmap_pg_cnt * PG_SIZE);
     child_thread->userprog_vaddr.vaddr_bitmap.bits = (uint8_t *)vaddr_btmp;
+
+    // memcpy 复制来的 fpu_state 指向父进程的 FXSAVE 区域, 需为子进程单独复制一份
+    if (fpu_copy(child_thread, parent_thread) == -1) {
+        return -1;
+    }
     ASSERT(strlen(child_thread->name) < 15);    // pcb.name 的长度是 16, 为避免下面 strcat 越界
     strcat(child_thread->name, "f");
     return 0;
@@ -162,11 +188,12 @@ pid_t sys_fork(void) {
         return -1;
     }
 
-    ASSERT(!elem_find(&thread_ready_list, &child_thread->general_tag));
-    list_append(&thread_ready_list, &child_thread->general_tag);
-
     ASSERT(!elem_find(&thread_all_list, &child_thread->all_list_tag));
     list_append(&thread_all_list, &child_thread->all_list_tag);
+    pid_hash_add(child_thread);
+    wake_up_new_task(child_thread);
+
+    list_append(&parent_thread->children, &child_thread->child_tag);
 
     return child_thread->pid;
 }
@@ -0,0 +1,10 @@
+#ifndef __USERPROG_CLONE_H__
+#define __USERPROG_CLONE_H__
+
+#include "thread.h"
+
+
+pid_t sys_clone(void *entry, void *func, void *arg);
+pid_t sys_thread_join(pid_t tid, int32_t *status);
+
+#endif
@@ -12,6 +12,7 @@
 void process_execute(void *filename, char *name);
 
 void start_process(void *filename_);
+void jump_to_user(void *entry, void *ustack_top);
 void process_activate(task_struct *p_thread);
 void page_dir_activate(task_struct *p_thread);
 
@@ -14,8 +14,8 @@
 extern void intr_exit(void);
 
 
-void start_process(void *filename_) {
-    void *function = filename_;
+// 构造中断栈, 经 intr_exit 进入用户态从 entry 开始执行, 用户栈顶为 ustack_top
+void jump_to_user(void *entry, void *ustack_top) {
     task_struct *cur = running_thread();
     cur->self_kstack += sizeof(thread_stack);                   // 跨过 thread_stack, 指向 intr_stack
     intr_stack *proc_stack = (intr_stack *)cur->self_kstack;    // 可以不用定义成结构体指针
@@ -25,15 +25,21 @@ void start_process(void *filename_) {
 
     proc_stack->gs = 0;         // 不太允许用户态直接访问显存资源, 用户态用不上, 直接初始为 0
     proc_stack->ds = proc_stack->es = proc_stack->fs = SELECTOR_U_DATA;
-    proc_stack->eip = function; // 待执行的用户程序地址
+    proc_stack->eip = entry;    // 待执行的用户程序地址
     proc_stack->cs = SELECTOR_U_CODE;
     proc_stack->eflags = (EFLAGS_IOPL_0 | EFLAGS_MBS | EFLAGS_IF_1);
-    proc_stack->esp = (void *)((uint32_t)get_a_page(PF_USER, USER_STACK3_VADDR) + PG_SIZE);
+    proc_stack->esp = ustack_top;
     proc_stack->ss = SELECTOR_U_DATA;
     asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (proc_stack) : "memory");
 }
 
 
+void start_process(void *filename_) {
+    void *function = filename_;
+    jump_to_user(function, (void *)((uint32_t)get_a_page(PF_USER, USER_STACK3_VADDR) + PG_SIZE));
+}
+
+
 void page_dir_activate(task_struct *p_thread) {
     /********************************************************
      * 执行此函数时, 当前任务可能是线程
@@ -104,11 +110,10 @@ void process_execute(void *filename, char *name) {
 
     intr_status old_status = intr_disable();
 
-    ASSERT(!elem_find(&thread_ready_list, &thread->general_tag));
-    list_append(&thread_ready_list, &thread->general_tag);
-
     ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
     list_append(&thread_all_list, &thread->all_list_tag);
+    pid_hash_add(thread);
+    wake_up_new_task(thread);
 
     intr_set_status(old_status);
 }
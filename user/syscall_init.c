@@ -1,10 +1,21 @@
 #include "fs.h"
+#include "ide.h"
+#include "raid.h"
 #include "fork.h"
 #include "exec.h"
 #include "pipe.h"
+#include "blk.h"
+#include "clone.h"
+#include "futex.h"
+#include "cputime.h"
+#include "deadline.h"
 #include "print.h"
 #include "stdint.h"
+#include "sync.h"
 #include "string.h"
+#include "softirq.h"
+#include "interrupt.h"
+#include "workqueue.h"
 #include "thread.h"
 #include "console.h"
 #include "syscall.h"
@@ -13,6 +24,8 @@
 
 #include "syscall_init.h"
 
+#define PROG_START_SECTOR 400   // tools/compile.sh 把用户程序写到 sda 的此扇区, 位于 kernel.bin 之后
+
 
 typedef void *syscall;
 
@@ -39,6 +52,9 @@ void sys_help(void) {
       rm: remove a regular file\n\
       pwd: show current work directory\n\
       ps: show process information\n\
+      top: show cpu usage and scheduling statistics, top [rounds]\n\
+      nice: run a command with a lower priority (1~shell priority), nice [prio command [args]]\n\
+      kstat: show kernel statistics, kstat [irq|wq|lock|irqoff|blk|ide|raid]\n\
       clear: clear screen\n\
   shortcut key:\n\
       ctrl+l: clear screen\n\
@@ -64,7 +80,7 @@ static inline int32_t sys_ldprog(char *filename, uint32_t file_size) {
     uint32_t sec_cnt = DIV_ROUND_UP(file_size, 512);
     disk *sda = &channels[0].devices[0];
     void *prog_buf = sys_malloc(file_size);
-    ide_read(sda, 300, prog_buf, sec_cnt);
+    ide_read(sda, PROG_START_SECTOR, prog_buf, sec_cnt);
 
     int32_t fd = sys_open(filename, O_CREAT | O_RDWR);
     if (fd != -1) {
@@ -83,6 +99,36 @@ static inline int32_t sys_ldprog(char *filename, uint32_t file_size) {
 }
 
 
+// 打印内核子系统 name 的统计信息
+static int32_t sys_kstat(const char *name) {
+    if (!strcmp(name, "irq")) {
+        softirq_stat_print();
+    }
+    else if (!strcmp(name, "wq")) {
+        workqueue_stat_print();
+    }
+    else if (!strcmp(name, "lock")) {
+        lock_stat_print();
+    }
+    else if (!strcmp(name, "irqoff")) {
+        intr_trace_print();
+    }
+    else if (!strcmp(name, "blk")) {
+        blk_stat_print();
+    }
+    else if (!strcmp(name, "ide")) {
+        ide_stat_print();
+    }
+    else if (!strcmp(name, "raid")) {
+        raid_stat_print();
+    }
+    else {
+        return -1;
+    }
+    return 0;
+}
+
+
 void syscall_init(void) {
     put_str("\nsyscall_init start\n");
 
@@ -116,6 +162,17 @@ void syscall_init(void) {
     syscall_table[SYS_HELP] = (void *)sys_help;
     syscall_table[SYS_PAUSE] = (void *)sys_pause;
     syscall_table[SYS_LDPROG] = (void *)sys_ldprog;
+    syscall_table[SYS_KSTAT] = (void *)sys_kstat;
+    syscall_table[SYS_CLONE] = (void *)sys_clone;
+    syscall_table[SYS_THREAD_JOIN] = (void *)sys_thread_join;
+    syscall_table[SYS_FUTEX_WAIT] = (void *)sys_futex_wait;
+    syscall_table[SYS_FUTEX_WAKE] = (void *)sys_futex_wake;
+    syscall_table[SYS_TOP] = (void *)sys_top;
+    syscall_table[SYS_SETPRIORITY] = (void *)sys_setpriority;
+    syscall_table[SYS_GETPRIORITY] = (void *)sys_getpriority;
+    syscall_table[SYS_SCHED_SETDEADLINE] = (void *)sys_sched_setdeadline;
+    syscall_table[SYS_SCHED_DL_YIELD] = (void *)sys_sched_dl_yield;
+    syscall_table[SYS_GETRUSAGE] = (void *)sys_getrusage;
 
     put_str("syscall_init done\n");
 }
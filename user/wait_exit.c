@@ -1,12 +1,16 @@
 #include "fs.h"
 #include "list.h"
 #include "pipe.h"
+#include "process.h"
 #include "file.h"
 #include "debug.h"
 #include "global.h"
 #include "thread.h"
 #include "memory.h"
 #include "bitmap.h"
+#include "cputime.h"
+#include "deadline.h"
+#include "interrupt.h"
 #include "stdio_kernel.h"
 
 #include "wait_exit.h"
@@ -69,30 +73,33 @@ static void release_prog_resource(task_struct *release_thread) {
 }
 
 
-static bool find_child(list_elem* pelem, int32_t ppid) {
-    task_struct *pthread = elem2entry(task_struct, all_list_tag, pelem);
-    if (pthread->parent_pid == ppid) {
-        return true;
-    }
-    return false;
-}
-
+// 将 parent 的子进程全部过继给 init, 只需遍历 parent 自己的子进程队列
+static void init_adopt_children(task_struct *parent) {
+    task_struct *init_thread = pid2thread(1);
+    ASSERT(init_thread != NULL);
 
-static bool find_hanging_child(list_elem *pelem, int32_t ppid) {
-    task_struct *pthread = elem2entry(task_struct, all_list_tag, pelem);
-    if (pthread->parent_pid == ppid && pthread->status == TASK_HANGING) {
-        return true;
+    intr_status old_status = intr_disable();
+    while (!list_empty(&parent->children)) {
+        list_elem *pelem = list_pop(&parent->children);
+        task_struct *child = elem2entry(task_struct, child_tag, pelem);
+        child->parent_pid = 1;
+        list_append(&init_thread->children, pelem);
     }
-    return false;
-}
 
+    bool has_zombie = false;
+    while (!list_empty(&parent->zombie_children)) {
+        list_elem *pelem = list_pop(&parent->zombie_children);
+        task_struct *child = elem2entry(task_struct, child_tag, pelem);
+        child->parent_pid = 1;
+        list_append(&init_thread->zombie_children, pelem);
+        has_zombie = true;
+    }
 
-static bool init_adopt_a_child(list_elem *pelem, int32_t pid) {
-    task_struct *pthread = elem2entry(task_struct, all_list_tag, pelem);
-    if (pthread->parent_pid == pid) {
-        pthread->parent_pid = 1;
+    // 过继来的子进程已经退出, 需要唤醒等待中的 init 去回收
+    if (has_zombie && init_thread->status == TASK_WAITING) {
+        thread_unblock(init_thread);
     }
-    return false;
+    intr_set_status(old_status);
 }
 
 
@@ -100,26 +107,32 @@ pid_t sys_wait(int32_t *status) {
     task_struct *parent_thread = running_thread();
 
     while (1) {
+        // 检查和阻塞须在关中断下完成, 否则子进程的唤醒可能发生在阻塞之前而丢失
+        intr_status old_status = intr_disable();
+
         // 优先处理已经是挂起状态的任务
-        list_elem *child_elem = list_traversal(&thread_all_list, find_hanging_child, parent_thread->pid);
+        if (!list_empty(&parent_thread->zombie_children)) {
+            list_elem *child_elem = list_pop(&parent_thread->zombie_children);
+            intr_set_status(old_status);
 
-        if (child_elem != NULL) {
-            task_struct *child_thread = elem2entry(task_struct, all_list_tag, child_elem);
+            task_struct *child_thread = elem2entry(task_struct, child_tag, child_elem);
+            ASSERT(child_thread->status == TASK_HANGING);
             *status = child_thread->exit_status;
 
             uint16_t child_pid = child_thread->pid;
 
+            acct_reap(parent_thread, child_thread);
             thread_exit(child_thread, false);
             return child_pid;
         }
 
-        child_elem = list_traversal(&thread_all_list, find_child, parent_thread->pid);
-        if (child_elem == NULL) {
+        if (list_empty(&parent_thread->children)) {
+            intr_set_status(old_status);
             return -1;
         }
-        else {
-            thread_block(TASK_WAITING);
-        }
+
+        thread_block(TASK_WAITING);
+        intr_set_status(old_status);
     }
 }
 
@@ -131,11 +144,33 @@ void sys_exit(int32_t status) {
         PANIC("sys_exit: child_thread->parent_pid is -1\n");
     }
 
-    list_traversal(&thread_all_list, init_adopt_a_child, child_thread->pid);
+    init_adopt_children(child_thread);
+    dl_release(child_thread);   // 尽早归还截止期限任务占用的带宽
 
-    release_prog_resource(child_thread);
+    // 地址空间和文件由同一进程的所有线程共享, 只有最后一个退出的线程才释放
+    task_group *group = child_thread->group;
+    if (task_group_put(child_thread) == 0) {
+        release_prog_resource(child_thread);
+        kfree(group);
+    }
+    else {
+        if (child_thread->ustack != NULL) {
+            mfree_page(PF_USER, child_thread->ustack, 1);
+        }
+        // 页目录仍被其它线程使用, 不能由 thread_exit 释放.
+        // 先切换到内核页目录, 此后本任务只在内核态运行
+        child_thread->pgdir = NULL;
+        page_dir_activate(child_thread);
+    }
+    child_thread->fd_table = NULL;
+    child_thread->u_block_desc = NULL;
 
     task_struct *parent_thread = pid2thread(child_thread->parent_pid);
+
+    // 从父进程的 children 移到 zombie_children, 直到 thread_block 切走前都不能被调度
+    intr_disable();
+    list_remove(&child_thread->child_tag);
+    list_append(&parent_thread->zombie_children, &child_thread->child_tag);
     if (parent_thread->status == TASK_WAITING) {
         thread_unblock(parent_thread);
     }